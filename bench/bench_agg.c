@@ -0,0 +1,131 @@
+/**
+ * Scaling of parallel hash aggregation with thread count, from 1 thread up to the number of cores online
+ * (at most 64), against a single map filled row by row with `chmap_upsert`. More threads than cores can
+ * only show the cost of contending for them, so they aren't run. Inputs have few groups (fits in cache)
+ * and many (DRAM bound), and keys are drawn uniformly at random.
+ *
+ * Prints CSV: cores online, groups, threads, partitions, nanoseconds per row, millions of rows per second,
+ * and speedup over the single map. Pass a row count as the first argument to change it.
+ *
+ * Usage: bench_agg [rows]
+ */
+#define _GNU_SOURCE
+#define CHMAP_AGG
+#include "../chmap_onefile.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static void add_u64s(void * acc, const void * value, void * ctx) {
+    (void)ctx;
+
+    *(uint64_t *)acc += *(const uint64_t *)value;
+}
+
+static void print_row(
+    const size_t cores,
+    const size_t groups,
+    const size_t threads,
+    const size_t partitions,
+    const size_t rows,
+    const uint64_t elapsed,
+    const uint64_t baseline
+) {
+    printf("%zu,%zu,%zu,%zu,%.1f,%.1f,%.2f\n", cores, groups, threads, partitions, (double)elapsed / rows,
+           rows * 1e3 / elapsed, (double)baseline / elapsed);
+    fflush(stdout);
+}
+
+/**
+ * Thread counts run: powers of two up to `cores`, and then `cores` itself if it isn't one.
+ */
+static size_t next_thread_count(const size_t threads, const size_t cores) {
+    return threads * 2 <= cores || threads == cores ? threads * 2 : cores;
+}
+
+static void bench_groups(
+    const uint64_t * keys,
+    const uint64_t * values,
+    const size_t rows,
+    const size_t groups,
+    const size_t cores
+) {
+    uint64_t start = now_ns();
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(uint64_t));
+
+    for (size_t i = 0; i < rows; i++) {
+        int inserted;
+        uint64_t * acc = chmap_upsert(map, &keys[i], &inserted);
+        *acc += values[i];
+    }
+
+    const uint64_t baseline = now_ns() - start;
+    chmap_free(map);
+
+    print_row(cores, groups, 0, 1, rows, baseline, baseline);
+
+    for (size_t threads = 1; threads <= cores; threads = next_thread_count(threads, cores)) {
+        start = now_ns();
+        const size_t partitions = chmap_agg_fanout(groups, sizeof(uint64_t), threads);
+        struct chmap_agg * agg = chmap_agg_run(
+            keys, values, rows, sizeof(uint64_t), sizeof(uint64_t), add_u64s, NULL, threads, partitions
+        );
+        const uint64_t elapsed = now_ns() - start;
+
+        print_row(cores, groups, threads, agg->partition_count, rows, elapsed, baseline);
+        chmap_agg_free(agg);
+    }
+}
+
+int main(int argc, char ** argv) {
+    static const size_t group_counts[] = {1000, 1000000};
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t cores = online < 1 ? 1 : online > MAX_THREADS ? MAX_THREADS : (size_t)online;
+    size_t rows = 10000000;
+
+    if (argc > 1) {
+        rows = strtoull(argv[1], NULL, 10);
+    }
+
+    uint64_t * keys = malloc(rows * sizeof(uint64_t));
+    uint64_t * values = malloc(rows * sizeof(uint64_t));
+
+    // The single map baseline is reported as 0 threads.
+    printf("cores,groups,threads,partitions,ns_per_row,mrows_per_sec,speedup\n");
+
+    for (size_t g = 0; g < sizeof(group_counts) / sizeof(group_counts[0]); g++) {
+        uint64_t state = 88172645463325252ULL;
+
+        for (size_t i = 0; i < rows; i++) {
+            keys[i] = xorshift(&state) % group_counts[g];
+            values[i] = i;
+        }
+
+        bench_groups(keys, values, rows, group_counts[g], cores);
+    }
+
+    free(keys);
+    free(values);
+
+    return 0;
+}
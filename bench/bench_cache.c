@@ -0,0 +1,160 @@
+/**
+ * Hit ratio and throughput of LRU against CLOCK eviction, replaying a zipfian trace through caches
+ * holding 1% and 10% of the keys. Every request is a get, followed by a put when it misses. A second
+ * pass replays the trace with gets only, to show what each policy costs on the read path.
+ *
+ * Prints CSV: policy, keys, capacity, requests, hit ratio, nanoseconds per request, nanoseconds per get.
+ * Pass the number of distinct keys as the first argument to change it. The capacities and the length of
+ * the trace scale with it, so that the caches always fill up and evict.
+ *
+ * Usage: bench_cache [keys]
+ */
+#define _GNU_SOURCE
+#include "../chmap_onefile.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Requests in the trace per distinct key, so that even the larger cache is filled many times over.
+#define REQUESTS_PER_KEY 10
+
+// Skew of the zipfian distribution; 0.99 matches YCSB.
+#define ZIPF_THETA 0.99
+
+static uint64_t xorshift(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static double uniform_double(uint64_t * state) {
+    return (xorshift(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Zipfian ranks in [0, n), after Gray et al., "Quickly Generating Billion-Record Synthetic
+ * Databases". Rank 0 is the hottest key.
+ */
+struct zipf {
+    uint64_t n;
+    double zetan;
+    double alpha;
+    double eta;
+    double half_pow_theta;
+};
+
+static void zipf_init(struct zipf * zipf, const uint64_t n) {
+    double zetan = 0.0;
+
+    for (uint64_t i = 1; i <= n; i++) {
+        zetan += 1.0 / pow((double)i, ZIPF_THETA);
+    }
+
+    const double zeta2 = 1.0 + 1.0 / pow(2.0, ZIPF_THETA);
+
+    zipf->n = n;
+    zipf->zetan = zetan;
+    zipf->alpha = 1.0 / (1.0 - ZIPF_THETA);
+    zipf->eta = (1.0 - pow(2.0 / n, 1.0 - ZIPF_THETA)) / (1.0 - zeta2 / zetan);
+    zipf->half_pow_theta = pow(0.5, ZIPF_THETA);
+}
+
+static uint64_t zipf_next(const struct zipf * zipf, uint64_t * state) {
+    const double u = uniform_double(state);
+    const double uz = u * zipf->zetan;
+
+    if (uz < 1.0) {
+        return 0;
+    }
+
+    if (uz < 1.0 + zipf->half_pow_theta) {
+        return 1;
+    }
+
+    const uint64_t rank = (uint64_t)(zipf->n * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+
+    return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+// Keeps the gets-only pass from being optimized away.
+static volatile size_t sink;
+
+static void bench_policy(
+    const enum chmap_evict_policy policy,
+    const size_t keys,
+    const size_t capacity,
+    const uint64_t * trace,
+    const size_t requests
+) {
+    struct chmap * map = chmap_cache_new(sizeof(uint64_t), sizeof(uint64_t), capacity, policy);
+    size_t hits = 0;
+
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < requests; i++) {
+        if (chmap_get(map, &trace[i]) != NULL) {
+            hits++;
+        } else {
+            chmap_put(map, &trace[i], &trace[i]);
+        }
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+
+    start = now_ns();
+
+    for (size_t i = 0; i < requests; i++) {
+        sink += chmap_get(map, &trace[i]) != NULL;
+    }
+
+    const uint64_t get_elapsed = now_ns() - start;
+
+    printf("%s,%zu,%zu,%zu,%.4f,%.1f,%.1f\n", policy == CHMAP_EVICT_LRU ? "lru" : "clock", keys, capacity,
+           requests, (double)hits / requests, (double)elapsed / requests, (double)get_elapsed / requests);
+    fflush(stdout);
+
+    chmap_free(map);
+}
+
+int main(int argc, char ** argv) {
+    size_t keys = 1000000;
+    struct zipf zipf;
+    uint64_t state = 88172645463325252ULL;
+
+    if (argc > 1) {
+        keys = strtoull(argv[1], NULL, 10);
+    }
+
+    const size_t capacities[] = {keys / 100, keys / 10};
+    const size_t requests = keys * REQUESTS_PER_KEY;
+    uint64_t * trace = malloc(requests * sizeof(uint64_t));
+
+    zipf_init(&zipf, keys);
+
+    for (size_t i = 0; i < requests; i++) {
+        trace[i] = zipf_next(&zipf, &state);
+    }
+
+    printf("policy,keys,capacity,requests,hit_ratio,ns_per_request,ns_per_get\n");
+
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        bench_policy(CHMAP_EVICT_LRU, keys, capacities[c], trace, requests);
+        bench_policy(CHMAP_EVICT_CLOCK, keys, capacities[c], trace, requests);
+    }
+
+    free(trace);
+
+    return 0;
+}
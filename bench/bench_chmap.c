@@ -0,0 +1,601 @@
+/**
+ * Throughput and latency of the core map operations across map sizes, key sizes, value sizes and
+ * key distributions. Map sizes run from a few thousand entries (fits in L1/L2) up to tens of
+ * millions (DRAM bound); pass a maximum entry count as the first argument to stop sooner.
+ *
+ * Prints CSV, one row per (operation, distribution, entries, key size, value size). Throughput is
+ * measured over an untimed run of the operations; latency percentiles come from a second run that
+ * times operations individually, so they include the cost of one `clock_gettime` call.
+ *
+ * With `--perf` on Linux, the untimed run is also wrapped in hardware performance counters, which
+ * are reported per operation. Counters the kernel or hardware won't give us are left empty.
+ *
+ * Usage: bench_chmap [--perf] [max entries]
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _POSIX_C_SOURCE 199309L
+#endif
+#include "../chmap_onefile.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Lookups and mixed operations per row, regardless of map size.
+#define OPS (1 << 21)
+
+// At most this many operations are timed individually for the latency percentiles.
+#define LATENCY_SAMPLES (1 << 18)
+
+// Skew of the zipfian distribution; 0.99 matches YCSB.
+#define ZIPF_THETA 0.99
+
+#define MAX_KEY_SIZE 64
+#define MAX_VALUE_SIZE 64
+
+enum distribution {
+    DIST_SEQUENTIAL,
+    DIST_UNIFORM,
+    DIST_ZIPFIAN,
+};
+
+static const char * distribution_names[] = {"sequential", "uniform", "zipfian"};
+
+enum mixed_op {
+    MIXED_GET,
+    MIXED_PUT,
+    MIXED_DEL,
+};
+
+struct workload {
+    size_t entries;
+    size_t key_size;
+    size_t value_size;
+    enum distribution dist;
+};
+
+/**
+ * The hardware events counted with `--perf`, in CSV column order.
+ */
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTER_COUNT,
+};
+
+static const char * perf_counter_names[] = {"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"};
+
+// One file descriptor per counter, or -1 if it couldn't be opened or `--perf` wasn't given.
+static int perf_fds[PERF_COUNTER_COUNT];
+
+/**
+ * The cost of one run of a workload: wall time, plus each counter's value if it was counted.
+ */
+struct measurement {
+    uint64_t elapsed_ns;
+    uint64_t counters[PERF_COUNTER_COUNT];
+    int counted[PERF_COUNTER_COUNT];
+};
+
+static uint64_t xorshift(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static double uniform_double(uint64_t * state) {
+    return (xorshift(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef __linux__
+static int perf_open(const uint32_t type, const uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define PERF_CACHE_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/**
+ * Opens each counter on its own rather than as a group, so that one event the hardware lacks (common
+ * in VMs) doesn't take the others down with it. Returns how many could be opened.
+ */
+static int perf_init(void) {
+    int opened = 0;
+
+    perf_fds[PERF_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    perf_fds[PERF_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perf_fds[PERF_L1D_MISSES] = perf_open(PERF_TYPE_HW_CACHE, PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D));
+    perf_fds[PERF_LLC_MISSES] = perf_open(PERF_TYPE_HW_CACHE, PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_LL));
+    perf_fds[PERF_DTLB_MISSES] = perf_open(PERF_TYPE_HW_CACHE, PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB));
+    perf_fds[PERF_BRANCH_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (perf_fds[i] >= 0) {
+            opened++;
+        } else {
+            fprintf(stderr, "perf counter %s is unavailable\n", perf_counter_names[i]);
+        }
+    }
+
+    return opened;
+}
+
+static void perf_start(void) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (perf_fds[i] >= 0) {
+            ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void perf_stop(struct measurement * m) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        m->counted[i] = 0;
+
+        if (perf_fds[i] < 0) {
+            continue;
+        }
+
+        ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        m->counted[i] = read(perf_fds[i], &m->counters[i], sizeof(uint64_t)) == sizeof(uint64_t);
+    }
+}
+#else
+static int perf_init(void) {
+    fprintf(stderr, "perf counters are only supported on Linux\n");
+
+    return 0;
+}
+
+static void perf_start(void) {}
+
+static void perf_stop(struct measurement * m) {
+    memset(m->counted, 0, sizeof(m->counted));
+}
+#endif
+
+static void measure_start(struct measurement * m) {
+    perf_start();
+    m->elapsed_ns = now_ns();
+}
+
+static void measure_stop(struct measurement * m) {
+    m->elapsed_ns = now_ns() - m->elapsed_ns;
+    perf_stop(m);
+}
+
+/**
+ * Zipfian ranks in [0, n), after Gray et al., "Quickly Generating Billion-Record Synthetic
+ * Databases". Rank 0 is the hottest key.
+ */
+struct zipf {
+    uint64_t n;
+    double zetan;
+    double alpha;
+    double eta;
+    double half_pow_theta;
+};
+
+static void zipf_init(struct zipf * zipf, const uint64_t n) {
+    double zetan = 0.0;
+
+    for (uint64_t i = 1; i <= n; i++) {
+        zetan += 1.0 / pow((double)i, ZIPF_THETA);
+    }
+
+    const double zeta2 = 1.0 + 1.0 / pow(2.0, ZIPF_THETA);
+
+    zipf->n = n;
+    zipf->zetan = zetan;
+    zipf->alpha = 1.0 / (1.0 - ZIPF_THETA);
+    zipf->eta = (1.0 - pow(2.0 / n, 1.0 - ZIPF_THETA)) / (1.0 - zeta2 / zetan);
+    zipf->half_pow_theta = pow(0.5, ZIPF_THETA);
+}
+
+static uint64_t zipf_next(const struct zipf * zipf, uint64_t * state) {
+    const double u = uniform_double(state);
+    const double uz = u * zipf->zetan;
+
+    if (uz < 1.0) {
+        return 0;
+    }
+
+    if (uz < 1.0 + zipf->half_pow_theta) {
+        return 1;
+    }
+
+    const uint64_t rank = (uint64_t)(zipf->n * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+
+    return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+/**
+ * Writes the key for `index` into `key`. Longer keys are padded with bytes derived from the index
+ * so that the whole key has to be hashed.
+ */
+static void make_key(unsigned char * key, const size_t key_size, const uint64_t index) {
+    memcpy(key, &index, sizeof(uint64_t));
+
+    for (size_t i = sizeof(uint64_t); i < key_size; i++) {
+        key[i] = (unsigned char)(index * 31 + i);
+    }
+}
+
+/**
+ * Fills `indices` with `count` key indices in [offset, offset + n) drawn from the workload's
+ * distribution. Generated up front so the generators' cost stays out of the measurements.
+ */
+static void draw_indices(uint64_t * indices, const size_t count, const struct workload * w, const uint64_t offset, const struct zipf * zipf) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    for (size_t i = 0; i < count; i++) {
+        switch (w->dist) {
+            case DIST_SEQUENTIAL:
+                indices[i] = offset + i % w->entries;
+                break;
+            case DIST_UNIFORM:
+                indices[i] = offset + xorshift(&state) % w->entries;
+                break;
+            case DIST_ZIPFIAN:
+                indices[i] = offset + zipf_next(zipf, &state);
+                break;
+        }
+    }
+}
+
+/**
+ * Every index in [0, n) exactly once: in order for the sequential distribution, shuffled otherwise.
+ */
+static void permute_indices(uint64_t * indices, const size_t n, const enum distribution dist) {
+    uint64_t state = 0xD1B54A32D192ED03ULL;
+
+    for (size_t i = 0; i < n; i++) {
+        indices[i] = i;
+    }
+
+    if (dist == DIST_SEQUENTIAL) {
+        return;
+    }
+
+    for (size_t i = n - 1; i > 0; i--) {
+        const size_t j = xorshift(&state) % (i + 1);
+        const uint64_t tmp = indices[i];
+
+        indices[i] = indices[j];
+        indices[j] = tmp;
+    }
+}
+
+static int compare_u64(const void * a, const void * b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t * sorted, const size_t count, const double p) {
+    size_t index = (size_t)(p * count);
+
+    return sorted[index < count ? index : count - 1];
+}
+
+static void print_row(const char * op, const struct workload * w, const size_t ops, const struct measurement * m, uint64_t * latencies, const size_t samples) {
+    qsort(latencies, samples, sizeof(uint64_t), compare_u64);
+
+    printf("%s,%s,%zu,%zu,%zu,%zu,%.2f,%.2f,%llu,%llu,%llu,%llu",
+        op, distribution_names[w->dist], w->entries, w->key_size, w->value_size, ops,
+        (double)m->elapsed_ns / ops, ops * 1e3 / m->elapsed_ns,
+        (unsigned long long)percentile(latencies, samples, 0.50),
+        (unsigned long long)percentile(latencies, samples, 0.90),
+        (unsigned long long)percentile(latencies, samples, 0.99),
+        (unsigned long long)percentile(latencies, samples, 0.999));
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (m->counted[i]) {
+            printf(",%.2f", (double)m->counters[i] / ops);
+        } else {
+            printf(",");
+        }
+    }
+
+    printf("\n");
+}
+
+static struct chmap * filled_map(const struct workload * w) {
+    struct chmap * map = chmap_new(w->value_size, w->key_size);
+    unsigned char key[MAX_KEY_SIZE];
+    unsigned char value[MAX_VALUE_SIZE] = {0};
+
+    for (uint64_t i = 0; i < w->entries; i++) {
+        make_key(key, w->key_size, i);
+        chmap_put(map, key, value);
+    }
+
+    return map;
+}
+
+/**
+ * Inserts every key into an empty map, then deletes every key again, in sequential or shuffled
+ * order. Runs twice: once for throughput and once for latency.
+ */
+static void bench_put_del(const struct workload * w) {
+    uint64_t * order = malloc(w->entries * sizeof(uint64_t));
+    uint64_t * latencies = malloc(LATENCY_SAMPLES * sizeof(uint64_t));
+    const size_t stride = w->entries > LATENCY_SAMPLES ? w->entries / LATENCY_SAMPLES : 1;
+    unsigned char key[MAX_KEY_SIZE];
+    unsigned char value[MAX_VALUE_SIZE] = {0};
+    struct measurement put, del;
+    uint64_t start;
+
+    permute_indices(order, w->entries, w->dist);
+
+    struct chmap * map = chmap_new(w->value_size, w->key_size);
+
+    measure_start(&put);
+    for (size_t i = 0; i < w->entries; i++) {
+        make_key(key, w->key_size, order[i]);
+        chmap_put(map, key, value);
+    }
+    measure_stop(&put);
+
+    measure_start(&del);
+    for (size_t i = 0; i < w->entries; i++) {
+        make_key(key, w->key_size, order[i]);
+        chmap_del(map, key);
+    }
+    measure_stop(&del);
+
+    chmap_free(map);
+
+    size_t put_samples = 0;
+    map = chmap_new(w->value_size, w->key_size);
+
+    for (size_t i = 0; i < w->entries; i++) {
+        make_key(key, w->key_size, order[i]);
+
+        if (i % stride == 0 && put_samples < LATENCY_SAMPLES) {
+            start = now_ns();
+            chmap_put(map, key, value);
+            latencies[put_samples++] = now_ns() - start;
+        } else {
+            chmap_put(map, key, value);
+        }
+    }
+
+    print_row("put", w, w->entries, &put, latencies, put_samples);
+
+    size_t del_samples = 0;
+
+    for (size_t i = 0; i < w->entries; i++) {
+        make_key(key, w->key_size, order[i]);
+
+        if (i % stride == 0 && del_samples < LATENCY_SAMPLES) {
+            start = now_ns();
+            chmap_del(map, key);
+            latencies[del_samples++] = now_ns() - start;
+        } else {
+            chmap_del(map, key);
+        }
+    }
+
+    print_row("del", w, w->entries, &del, latencies, del_samples);
+
+    chmap_free(map);
+    free(latencies);
+    free(order);
+}
+
+/**
+ * Looks up `OPS` keys drawn from the distribution, either keys that are all in the map or keys
+ * that are all missing from it.
+ */
+static void bench_get(struct chmap * map, const struct workload * w, const struct zipf * zipf, const int hit) {
+    uint64_t * indices = malloc(OPS * sizeof(uint64_t));
+    uint64_t * latencies = malloc(LATENCY_SAMPLES * sizeof(uint64_t));
+    const size_t stride = OPS / LATENCY_SAMPLES;
+    unsigned char key[MAX_KEY_SIZE];
+    uintptr_t sink = 0;
+
+    draw_indices(indices, OPS, w, hit ? 0 : w->entries, zipf);
+
+    struct measurement get;
+
+    measure_start(&get);
+    for (size_t i = 0; i < OPS; i++) {
+        make_key(key, w->key_size, indices[i]);
+        sink += (uintptr_t)chmap_get(map, key);
+    }
+    measure_stop(&get);
+
+    for (size_t i = 0; i < LATENCY_SAMPLES; i++) {
+        make_key(key, w->key_size, indices[i * stride]);
+
+        const uint64_t start = now_ns();
+        sink += (uintptr_t)chmap_get(map, key);
+        latencies[i] = now_ns() - start;
+    }
+
+    if ((sink != 0) != hit) {
+        fprintf(stderr, "lookups didn't find what they should have!\n");
+    }
+
+    print_row(hit ? "get_hit" : "get_miss", w, OPS, &get, latencies, LATENCY_SAMPLES);
+
+    free(latencies);
+    free(indices);
+}
+
+/**
+ * 80% lookups, 10% puts and 10% deletes on keys drawn from the distribution. Deleted keys are put
+ * back by later puts, so the map stays roughly full.
+ */
+static void bench_mixed(const struct workload * w, const struct zipf * zipf) {
+    uint64_t * indices = malloc(OPS * sizeof(uint64_t));
+    unsigned char * ops = malloc(OPS);
+    uint64_t * latencies = malloc(LATENCY_SAMPLES * sizeof(uint64_t));
+    const size_t stride = OPS / LATENCY_SAMPLES;
+    unsigned char key[MAX_KEY_SIZE];
+    unsigned char value[MAX_VALUE_SIZE] = {0};
+    uint64_t state = 0xA0761D6478BD642FULL;
+    uintptr_t sink = 0;
+
+    draw_indices(indices, OPS, w, 0, zipf);
+
+    for (size_t i = 0; i < OPS; i++) {
+        const uint64_t roll = xorshift(&state) % 10;
+
+        ops[i] = roll < 8 ? MIXED_GET : roll == 8 ? MIXED_PUT : MIXED_DEL;
+    }
+
+    struct measurement mixed;
+
+    for (int timed = 0; timed <= 1; timed++) {
+        struct chmap * map = filled_map(w);
+        size_t samples = 0;
+
+        if (!timed) {
+            measure_start(&mixed);
+        }
+
+        for (size_t i = 0; i < OPS; i++) {
+            const int sample = timed && i % stride == 0;
+            uint64_t op_start = 0;
+
+            make_key(key, w->key_size, indices[i]);
+
+            if (sample) {
+                op_start = now_ns();
+            }
+
+            switch (ops[i]) {
+                case MIXED_GET:
+                    sink += (uintptr_t)chmap_get(map, key);
+                    break;
+                case MIXED_PUT:
+                    chmap_put(map, key, value);
+                    break;
+                case MIXED_DEL:
+                    chmap_del(map, key);
+                    break;
+            }
+
+            if (sample) {
+                latencies[samples++] = now_ns() - op_start;
+            }
+        }
+
+        // Throughput and counters come from the untimed run only.
+        if (timed) {
+            print_row("mixed", w, OPS, &mixed, latencies, samples);
+        } else {
+            measure_stop(&mixed);
+        }
+
+        chmap_free(map);
+    }
+
+    if (sink == 0) {
+        fprintf(stderr, "mixed lookups never found anything!\n");
+    }
+
+    free(latencies);
+    free(ops);
+    free(indices);
+}
+
+static void bench_workload(const struct workload * w) {
+    struct zipf zipf;
+
+    if (w->dist == DIST_ZIPFIAN) {
+        zipf_init(&zipf, w->entries);
+    } else {
+        bench_put_del(w);
+    }
+
+    struct chmap * map = filled_map(w);
+
+    bench_get(map, w, &zipf, 1);
+    bench_get(map, w, &zipf, 0);
+
+    chmap_free(map);
+
+    bench_mixed(w, &zipf);
+}
+
+int main(int argc, char ** argv) {
+    static const size_t key_sizes[] = {8, 64};
+    static const size_t value_sizes[] = {8, 64};
+    size_t max_entries = 10000000;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        perf_fds[i] = -1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--perf") == 0) {
+            if (perf_init() == 0) {
+                fprintf(stderr, "no perf counters available, continuing without them\n");
+            }
+        } else {
+            max_entries = strtoull(argv[i], NULL, 10);
+        }
+    }
+
+    printf("operation,distribution,entries,key_size,value_size,ops,ns_per_op,mops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns");
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        printf(",%s_per_op", perf_counter_names[i]);
+    }
+
+    printf("\n");
+
+    for (size_t entries = 1000; entries <= max_entries; entries *= 10) {
+        for (size_t k = 0; k < sizeof(key_sizes) / sizeof(key_sizes[0]); k++) {
+            for (size_t v = 0; v < sizeof(value_sizes) / sizeof(value_sizes[0]); v++) {
+                for (int dist = DIST_SEQUENTIAL; dist <= DIST_ZIPFIAN; dist++) {
+                    const struct workload w = {entries, key_sizes[k], value_sizes[v], (enum distribution)dist};
+
+                    bench_workload(&w);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
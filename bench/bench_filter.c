@@ -0,0 +1,111 @@
+/**
+ * Cost of gets with and without a front filter, at a range of miss rates, on a map filled right up to
+ * its maximum load factor so that misses probe long clusters. Keys are looked up in random order, so
+ * the maps don't fit in cache.
+ *
+ * Prints CSV: keys, miss ratio, filter bits per key (0 for none), nanoseconds per get, and the fraction
+ * of misses the filter let through. Pass the number of keys as the first argument to change it; the map
+ * is then topped up to its load limit, so a few more are used.
+ *
+ * Usage: bench_filter [keys]
+ */
+#define _GNU_SOURCE
+// The filter only counts false positives with CHMAP_STATS.
+#define CHMAP_STATS
+#include "../chmap_onefile.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t xorshift(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Keeps the gets from being optimized away.
+static volatile size_t sink;
+
+static void bench_gets(
+    struct chmap * map,
+    const size_t keys,
+    const double miss_ratio,
+    const size_t bits_per_key,
+    const uint64_t * lookups,
+    const size_t lookup_count
+) {
+    if (bits_per_key != 0) {
+        chmap_filter_enable(map, bits_per_key);
+    }
+
+    const uint64_t start = now_ns();
+
+    for (size_t i = 0; i < lookup_count; i++) {
+        sink += chmap_get(map, &lookups[i]) != NULL;
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+    const struct chmap_filter_counters * counters = chmap_get_filter_counters(map);
+    const size_t misses = counters != NULL ? counters->negatives + counters->false_positives : 0;
+
+    printf("%zu,%.2f,%zu,%.1f,%.4f\n", keys, miss_ratio, bits_per_key, (double)elapsed / lookup_count,
+           misses > 0 ? (double)counters->false_positives / misses : 0.0);
+    fflush(stdout);
+
+    chmap_filter_disable(map);
+}
+
+int main(int argc, char ** argv) {
+    static const double miss_ratios[] = {0.0, 0.5, 0.7, 0.9, 1.0};
+    static const size_t bits_per_key[] = {0, 8, 10, 16};
+    size_t keys = 1000000;
+    uint64_t state = 88172645463325252ULL;
+
+    if (argc > 1) {
+        keys = strtoull(argv[1], NULL, 10);
+    }
+
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(uint64_t));
+    const size_t lookup_count = keys * 4;
+    uint64_t * lookups = malloc(lookup_count * sizeof(uint64_t));
+
+    chmap_reserve(map, keys);
+
+    // Fill until the next put would grow the map, so it sits just under the maximum load factor.
+    for (uint64_t key = 0; map->used_size + 1 < map->array_size * MAX_LOAD_FACTOR; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    keys = map->used_size;
+
+    printf("keys,miss_ratio,bits_per_key,ns_per_get,false_positive_ratio\n");
+
+    for (size_t m = 0; m < sizeof(miss_ratios) / sizeof(miss_ratios[0]); m++) {
+        // Keys at or past `keys` were never put, so they miss.
+        for (size_t i = 0; i < lookup_count; i++) {
+            const int miss = (xorshift(&state) >> 11) * (1.0 / 9007199254740992.0) < miss_ratios[m];
+
+            lookups[i] = miss ? keys + xorshift(&state) % keys : xorshift(&state) % keys;
+        }
+
+        for (size_t b = 0; b < sizeof(bits_per_key) / sizeof(bits_per_key[0]); b++) {
+            bench_gets(map, keys, miss_ratios[m], bits_per_key[b], lookups, lookup_count);
+        }
+    }
+
+    free(lookups);
+    chmap_free(map);
+
+    return 0;
+}
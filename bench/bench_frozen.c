@@ -0,0 +1,84 @@
+/**
+ * Compares lookups in a frozen map against lookups in the mutable map it was frozen from.
+ * Prints CSV: structure, entries, nanoseconds per lookup.
+ * Pass a maximum entry count as the first argument to stop sooner.
+ *
+ * Usage: bench_frozen [max entries]
+ */
+#include "../chmap_onefile.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUPS 10000000
+
+static uint64_t xorshift(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static double seconds_since(const clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void bench_size(const uint64_t entries) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(uint64_t));
+
+    for (uint64_t key = 0; key < entries; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    clock_t start = clock();
+    struct chmap_frozen * frozen = chmap_freeze(map);
+    const double freeze_seconds = seconds_since(start);
+
+    uint64_t state = 88172645463325252ULL;
+    uint64_t sink = 0;
+
+    start = clock();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        const uint64_t key = xorshift(&state) % entries;
+        sink += *(uint64_t *)chmap_get(map, &key);
+    }
+    const double get_seconds = seconds_since(start);
+
+    state = 88172645463325252ULL;
+
+    start = clock();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        const uint64_t key = xorshift(&state) % entries;
+        sink -= *(uint64_t *)chmap_frozen_get(frozen, &key);
+    }
+    const double frozen_seconds = seconds_since(start);
+
+    printf("chmap_get,%llu,%.1f\n", (unsigned long long)entries, get_seconds * 1e9 / LOOKUPS);
+    printf("chmap_frozen_get,%llu,%.1f\n", (unsigned long long)entries, frozen_seconds * 1e9 / LOOKUPS);
+    printf("chmap_freeze,%llu,%.1f\n", (unsigned long long)entries, freeze_seconds * 1e9 / entries);
+
+    if (sink != 0) {
+        fprintf(stderr, "frozen and mutable lookups disagreed!\n");
+    }
+
+    chmap_frozen_free(frozen);
+    chmap_free(map);
+}
+
+int main(int argc, char ** argv) {
+    uint64_t max_entries = 10000000;
+
+    if (argc > 1) {
+        max_entries = strtoull(argv[1], NULL, 10);
+    }
+
+    printf("operation,entries,ns_per_op\n");
+
+    for (uint64_t entries = 1000; entries <= max_entries; entries *= 10) {
+        bench_size(entries);
+    }
+
+    return 0;
+}
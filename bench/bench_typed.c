@@ -0,0 +1,91 @@
+/**
+ * Compares a typed map from CHMAP_DEFINE against a runtime-sized map with the same keys and items.
+ * Prints CSV: operation, entries, nanoseconds per operation.
+ * Pass a maximum entry count as the first argument to stop sooner.
+ *
+ * Usage: bench_typed [max entries]
+ */
+#include "../chmap_onefile.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUPS 10000000
+
+CHMAP_DEFINE(u64_map, uint64_t, uint64_t, chmap_hash_u64, CHMAP_EQ)
+
+static uint64_t xorshift(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static double seconds_since(const clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void bench_size(const uint64_t entries) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(uint64_t));
+    struct u64_map * typed = u64_map_new();
+
+    clock_t start = clock();
+    for (uint64_t key = 0; key < entries; key++) {
+        chmap_put(map, &key, &key);
+    }
+    const double put_seconds = seconds_since(start);
+
+    start = clock();
+    for (uint64_t key = 0; key < entries; key++) {
+        u64_map_put(typed, key, key);
+    }
+    const double typed_put_seconds = seconds_since(start);
+
+    uint64_t state = 88172645463325252ULL;
+    uint64_t sink = 0;
+
+    start = clock();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        const uint64_t key = xorshift(&state) % entries;
+        sink += *(uint64_t *)chmap_get(map, &key);
+    }
+    const double get_seconds = seconds_since(start);
+
+    state = 88172645463325252ULL;
+
+    start = clock();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        sink -= *u64_map_get(typed, xorshift(&state) % entries);
+    }
+    const double typed_get_seconds = seconds_since(start);
+
+    printf("chmap_put,%llu,%.1f\n", (unsigned long long)entries, put_seconds * 1e9 / entries);
+    printf("typed_put,%llu,%.1f\n", (unsigned long long)entries, typed_put_seconds * 1e9 / entries);
+    printf("chmap_get,%llu,%.1f\n", (unsigned long long)entries, get_seconds * 1e9 / LOOKUPS);
+    printf("typed_get,%llu,%.1f\n", (unsigned long long)entries, typed_get_seconds * 1e9 / LOOKUPS);
+
+    if (sink != 0) {
+        fprintf(stderr, "typed and runtime-sized lookups disagreed!\n");
+    }
+
+    u64_map_free(typed);
+    chmap_free(map);
+}
+
+int main(int argc, char ** argv) {
+    uint64_t max_entries = 10000000;
+
+    if (argc > 1) {
+        max_entries = strtoull(argv[1], NULL, 10);
+    }
+
+    printf("operation,entries,ns_per_op\n");
+
+    for (uint64_t entries = 1000; entries <= max_entries; entries *= 10) {
+        bench_size(entries);
+    }
+
+    return 0;
+}
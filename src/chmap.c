@@ -4,6 +4,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef CHMAP_JOURNAL_FSYNC
+#include <unistd.h>
+#endif
 
 #include "siphash.h"
 #include "chmap.h"
@@ -11,6 +16,67 @@
 #define DEFAULT_BACKING_ARRAY_LENGTH 20
 #define ARRAY_GROW_FACTOR 2.0f
 #define MAX_LOAD_FACTOR 0.9f
+// Below this load, chmap_clear visits occupied slots one by one instead of wiping the whole array.
+#define CLEAR_SPARSE_LOAD_FACTOR 0.25f
+// Load of a full bounded map. Kept well under MAX_LOAD_FACTOR, since a full cache stays full, and every
+// eviction and insert would otherwise walk the long probe runs of a nearly full array.
+#define CACHE_LOAD_FACTOR 0.5f
+
+#define JOURNAL_MAGIC "CHMJ"
+#define JOURNAL_OP_PUT 'P'
+#define JOURNAL_OP_DEL 'D'
+// The journal is compacted once it holds this many times more records than the map holds entries.
+#define JOURNAL_COMPACT_FACTOR 4
+
+// Average number of keys per bucket in a frozen map. Fewer means faster freezing, but more pilots.
+#define FROZEN_BUCKET_SIZE 6
+// A frozen map places keys into `n + n / FROZEN_SPARE_DIVISOR + 1` positions before remapping.
+#define FROZEN_SPARE_DIVISOR 64
+#define FROZEN_MAX_PILOT UINT16_MAX
+#define FROZEN_SEED_ATTEMPTS 16
+
+#define BIT_GET(bits, i) (((bits)[(i) / 64] >> ((i) % 64)) & 1)
+#define BIT_SET(bits, i) ((bits)[(i) / 64] |= UINT64_C(1) << ((i) % 64))
+#define BIT_CLEAR(bits, i) ((bits)[(i) / 64] &= ~(UINT64_C(1) << ((i) % 64)))
+
+// How many keys the batched functions hash and prefetch before probing for any of them.
+#define BATCH_SIZE 16
+
+// Past this many partitions, a join's build spends more on scattered writes than it saves in cache misses.
+#define JOIN_MAX_PARTITIONS 256
+
+// Marks either end of an LRU map's recency list.
+#define LRU_NONE SIZE_MAX
+
+// CLOCK bits of a backing array index: whether it holds an item, and whether that was used since the
+// hand last passed it.
+#define CLOCK_USED 1
+#define CLOCK_REFERENCED 2
+
+// Marks either end of a timer wheel slot's list.
+#define TTL_NONE SIZE_MAX
+
+// A front filter block is eight words, so that it fills one 64-byte cache line, and starts on one.
+#define FILTER_BLOCK_WORDS 8
+#define FILTER_ALIGN 64
+
+// A front filter is rebuilt once the keys removed since it was built reach 1/FILTER_STALE_DIVISOR of the
+// keys it was sized for.
+#define FILTER_STALE_DIVISOR 4
+
+#ifdef __GNUC__
+#define PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#define PREFETCH(ptr) ((void)0)
+#endif
+
+#ifdef CHMAP_STATS
+#define STAT_ADD(map, counter, n) ((map)->counters.counter += (n))
+#define STAT_FILTER_LOOKUP(map, hash, index) filter_count_lookup(map, hash, index)
+#else
+#define STAT_ADD(map, counter, n) ((void)0)
+#define STAT_FILTER_LOOKUP(map, hash, index) ((void)0)
+#endif
 
 
 // siphash is a cryptographic hash; it doesn't matter much for our use case, so we can use a bad key.
@@ -48,17 +114,175 @@ static size_t * init_bais_stack(
     size_t numentries
 );
 
+static void push_bais_idx(
+    struct chmap * map,
+    size_t val
+);
+
+static void journal_append(
+    struct chmap * map,
+    const char op,
+    const uint64_t hash,
+    const void * item
+);
+
+static void journal_commit(
+    struct chmap * map
+);
+
+static void journal_record(
+    struct chmap * map,
+    const char op,
+    const uint64_t hash,
+    const void * item
+);
+
 static inline void * get_ba_ptr(
     struct chmap * map,
     size_t index
 );
 
-static inline void * get_ba_ptr_arr(
-    void * ba,
-    size_t isize,
-    size_t index
+static inline void * entry_item(
+    struct chmap * map,
+    struct entry * entry
+);
+
+static inline uint64_t clock_ns(void);
+
+static void histogram_record(
+    struct chmap_histogram * histogram,
+    const uint64_t value
+);
+
+static void lru_insert(
+    struct chmap_lru * lru,
+    const size_t index,
+    const uint64_t hash
+);
+
+static void lru_remove(
+    struct chmap_lru * lru,
+    const size_t index
+);
+
+static void lru_touch(
+    struct chmap_lru * lru,
+    const size_t index
+);
+
+static void lru_evict(
+    struct chmap * map
+);
+
+static void lru_resize(
+    struct chmap_lru * lru,
+    const size_t old_size,
+    const size_t new_size
+);
+
+static void lru_clear(
+    struct chmap_lru * lru,
+    const size_t array_size
+);
+
+static size_t lru_slot_bytes(
+    const enum chmap_evict_policy policy
+);
+
+static struct chmap_lru * lru_clone(
+    const struct chmap_lru * lru,
+    const size_t array_size
+);
+
+static void lru_free(
+    struct chmap_lru * lru
+);
+
+static void ttl_insert(
+    struct chmap_ttl * ttl,
+    const size_t index,
+    const uint64_t hash
+);
+
+static void ttl_remove(
+    struct chmap_ttl * ttl,
+    const size_t index
+);
+
+static int ttl_due(
+    struct chmap * map,
+    const size_t index
+);
+
+static size_t ttl_expire_if_due(
+    struct chmap * map,
+    const size_t index
+);
+
+static void ttl_resize(
+    struct chmap_ttl * ttl,
+    const size_t old_size,
+    const size_t new_size
+);
+
+static void ttl_clear(
+    struct chmap_ttl * ttl,
+    const size_t array_size
+);
+
+static struct chmap_ttl * ttl_clone(
+    const struct chmap_ttl * ttl,
+    const size_t array_size
+);
+
+static void ttl_free(
+    struct chmap_ttl * ttl
+);
+
+static void filter_add(
+    struct chmap_filter * filter,
+    const uint64_t hash
+);
+
+static int filter_check(
+    const struct chmap_filter * filter,
+    const uint64_t hash
+);
+
+static uint64_t * filter_block(
+    const struct chmap_filter * filter,
+    const uint64_t hash
+);
+
+static void filter_build(
+    struct chmap * map
+);
+
+static void filter_deleted(
+    struct chmap * map,
+    const size_t count
+);
+
+static void filter_clear(
+    struct chmap_filter * filter
+);
+
+static struct chmap_filter * filter_clone(
+    const struct chmap_filter * filter
 );
 
+static void filter_free(
+    struct chmap_filter * filter
+);
+
+#ifdef CHMAP_STATS
+static void filter_count_lookup(
+    struct chmap * map,
+    const uint64_t hash,
+    const size_t index
+);
+#endif
+
 /**
  * Takes an entry and a location and tries to insert it at the location, performing
  * robinhood shuffling if necessary to maintain low PSL or whatever.
@@ -80,6 +304,7 @@ static void bubble_up(struct chmap * map, const struct entry inentry, size_t ind
             // if an entry has a lower PSL than our current one, swap.
             map->translation_array[ind] = grabbed_entry;
             grabbed_entry = working_entry;
+            STAT_ADD(map, shifts, 1);
         }
 
         grabbed_entry.psl++;
@@ -96,15 +321,109 @@ static struct probe_sequence probe_array(struct chmap *map, const uint64_t key)
 
     struct entry working_entry = map->translation_array[working_index];
 
-    while (working_entry.has_entry == 1 && working_entry.keyword != key && working_entry.psl >= psl) {
-        working_entry = map->translation_array[working_index];
+    // Multimaps add another entry for a key instead of overwriting, so they don't stop at a match.
+    const int stop_at_key = !(map->flags & CHMAP_MULTIMAP);
+
+    while (working_entry.has_entry == 1 && !(stop_at_key && working_entry.keyword == key) && working_entry.psl >= psl) {
         working_index = (working_index + 1) % map->array_size;
+        working_entry = map->translation_array[working_index];
         psl++;
     }
 
+    STAT_ADD(map, probe_steps, psl);
+
     return (struct probe_sequence){ working_index, psl};
 }
 
+/**
+ * Given a chmap and a hash, returns the index of the entry holding that hash, or `map->array_size` if
+ * there is no such entry. The search stops as soon as it passes an entry that is closer to home than
+ * the hash would be, since robinhood ordering guarantees the hash can't be further down the cluster.
+ */
+static size_t find_hash(struct chmap * map, const uint64_t hash) {
+    if (map->filter != NULL && !filter_check(map->filter, hash)) {
+        return map->array_size;
+    }
+
+    size_t working_index = hash % map->array_size;
+    size_t psl = 0;
+
+    struct entry working_entry = map->translation_array[working_index];
+
+    while (working_entry.has_entry == 1 && working_entry.psl >= psl) {
+        if (working_entry.keyword == hash) {
+            STAT_ADD(map, probe_steps, psl);
+            return working_index;
+        }
+
+        working_index = (working_index + 1) % map->array_size;
+        working_entry = map->translation_array[working_index];
+        psl++;
+    }
+
+    STAT_ADD(map, probe_steps, psl);
+
+    return map->array_size;
+}
+
+/**
+ * Removes the entry at `index` from the translation array, returning its backing array slot to the stack.
+ * Entries after it are shifted back by one until an empty spot or an entry already at its home is hit.
+ */
+static void remove_entry(struct chmap * map, size_t index) {
+    if (!(map->flags & CHMAP_INLINE_ITEMS)) {
+        push_bais_idx(map, map->translation_array[index].backing_array_key);
+    }
+
+    if (map->lru != NULL) {
+        lru_remove(map->lru, map->translation_array[index].backing_array_key);
+    }
+
+    if (map->ttl != NULL) {
+        ttl_remove(map->ttl, map->translation_array[index].backing_array_key);
+    }
+
+    size_t next_index = (index + 1) % map->array_size;
+    struct entry next = map->translation_array[next_index];
+
+    while (next.has_entry && next.psl > 0) {
+        next.psl--;
+        map->translation_array[index] = next;
+        STAT_ADD(map, shifts, 1);
+
+        index = next_index;
+        next_index = (next_index + 1) % map->array_size;
+        next = map->translation_array[next_index];
+    }
+
+    map->translation_array[index] = (struct entry){ .has_entry = 0 };
+    map->used_size--;
+
+    if (map->filter != NULL) {
+        filter_deleted(map, 1);
+    }
+}
+
+/**
+ * Deletes the entry holding `hash`. Returns 1 if there was one, or 0 if the map didn't contain it.
+ */
+static int chmap_del_hash(struct chmap * map, const uint64_t hash) {
+    size_t index = find_hash(map, hash);
+
+    if (index == map->array_size) {
+        return 0;
+    }
+
+    remove_entry(map, index);
+
+    // A multimap can have more entries for the same key.
+    while (map->flags & CHMAP_MULTIMAP && (index = find_hash(map, hash)) != map->array_size) {
+        remove_entry(map, index);
+    }
+
+    return 1;
+}
+
 /**
  * Initializes an array of empty entries, with size `numentries`.
  */
@@ -122,41 +441,103 @@ static struct entry * init_translation_array(const size_t numentries) {
 }
 
 /**
- * Given a map, increases its size by ARRAY_GROW_FACTOR and copies the entries and data from the backing array over.
+ * Puts an entry back into the translation array after a resize, keeping its item where it is.
  */
-static void grow_map(struct chmap * map) {
-    size_t new_size = map->array_size * ARRAY_GROW_FACTOR;
+static void reinsert_entry(struct chmap * map, struct entry entry) {
+    const struct probe_sequence probe = probe_array(map, entry.keyword);
+
+    entry.psl = probe.psl;
+    bubble_up(map, entry, probe.index);
+    map->used_size++;
+}
+
+/**
+ * Given a map, changes its size to `new_size`. Entries are rehashed into the new translation array, but
+ * items stay at the same backing array indices.
+ */
+static void resize_map(struct chmap * map, const size_t new_size) {
     size_t old_size = map->array_size;
+    struct chmap_grow_event event = {CHMAP_GROW_START, old_size, new_size, map->used_size, 0};
+    uint64_t start = 0;
+
+    if (map->grow_hook != NULL) {
+        map->grow_hook(&event, map->grow_hook_ctx);
+        start = clock_ns();
+    }
+
+    map->grow_count++;
 
-    void * old_backing_array = map->backing_array;
-    size_t * old_bais = map->bais;
     struct entry * old_translation_array = map->translation_array;
 
-    void * new_backing_array = malloc(map->isize * new_size);
-    size_t * new_bais = init_bais_stack(new_size);
-    struct entry * new_translation_array = init_translation_array(new_size);
-    
-    // Instead of writing some jank code, we'll just reuse the put item operation.
-    // This requires us to act like there's no items in the array.
-    map->backing_array = new_backing_array;
-    map->translation_array = new_translation_array;
+    if (!(map->flags & CHMAP_INLINE_ITEMS)) {
+        // Items keep their backing array indices, so the backing array is copied over as it is, and the
+        // new indices go under the free ones on the stack.
+        const size_t added = new_size - old_size;
+        const size_t free_count = old_size - map->used_size;
+        void * new_backing_array = malloc(map->isize * new_size);
+        size_t * new_bais = malloc(new_size * sizeof(size_t));
+
+        memcpy(new_backing_array, map->backing_array, map->isize * old_size);
+
+        for (size_t i = 0; i < added; i++) {
+            new_bais[i] = new_size - 1 - i;
+        }
+
+        memcpy(&new_bais[added], map->bais, free_count * sizeof(size_t));
+
+        free(map->backing_array);
+        free(map->bais);
+
+        map->backing_array = new_backing_array;
+        map->bais = new_bais;
+        map->bais_idx = added + free_count - 1;
+    }
+
+    if (map->lru != NULL) {
+        lru_resize(map->lru, old_size, new_size);
+    }
+
+    if (map->ttl != NULL) {
+        ttl_resize(map->ttl, old_size, new_size);
+    }
+
+    map->translation_array = init_translation_array(new_size);
     map->array_size = new_size;
-    // This is so we can reset backing array indices.
     map->used_size = 0;
-    map->bais_idx = new_size - 1;
-    map->bais = new_bais;
 
     for (size_t i = 0; i < old_size; i++) {
-        struct entry entry = old_translation_array[i];
-        if (entry.has_entry) {
-            void * ba_ptr = get_ba_ptr_arr(old_backing_array, map->isize, entry.backing_array_key);
-            chmap_put_hash(map, entry.keyword, ba_ptr);
+        if (old_translation_array[i].has_entry) {
+            reinsert_entry(map, old_translation_array[i]);
         }
     }
 
-    free(old_backing_array);
     free(old_translation_array);
-    free(old_bais);
+
+    if (map->filter != NULL) {
+        filter_build(map);
+    }
+
+    if (map->grow_hook != NULL) {
+        event.phase = CHMAP_GROW_END;
+        event.elapsed_ns = clock_ns() - start;
+        map->grow_hook(&event, map->grow_hook_ctx);
+    }
+}
+
+/**
+ * Given a map, increases its size by ARRAY_GROW_FACTOR.
+ */
+static void grow_map(struct chmap * map) {
+    resize_map(map, map->array_size * ARRAY_GROW_FACTOR);
+}
+
+/**
+ * Fills a stack of backing array indices, so that the top entry is 0, and the bottom entry is `numentries - 1`.
+ */
+static void fill_bais_stack(size_t * stack, size_t numentries) {
+    for (size_t i = 0; i < numentries; i++) {
+        stack[i] = numentries - 1 - i;
+    }
 }
 
 /**
@@ -165,9 +546,7 @@ static void grow_map(struct chmap * map) {
 static size_t * init_bais_stack(size_t numentries) {
     size_t * stack = calloc(numentries, sizeof(size_t));
 
-    for (size_t i = 0; i < numentries; i++) {
-        stack[i] = numentries - i;
-    }
+    fill_bais_stack(stack, numentries);
 
     return stack;
 }
@@ -197,169 +576,2549 @@ static void push_bais_idx(struct chmap * map, size_t val) {
 }
 
 /**
- * Given a pointer to a backing array, the item size, and an index, gets the pointer to the item at `index`.
+ * Given a map and an index, gets the pointer to the item at `index`.
  */
-static inline void * get_ba_ptr_arr(
-    void * ba,
-    size_t isize,
-    size_t index
-) {
-    return ((char*)ba) + index * isize; 
+static inline void * get_ba_ptr(struct chmap * map, size_t index) {
+    return ((char*)map->backing_array) + index * map->isize;
 }
 
 /**
- * Given a map and an index, gets the pointer to the item at `index`.
+ * Given a map and one of its entries, gets the pointer to the entry's item: in the entry itself if the
+ * map has inline items, or in the backing array otherwise.
  */
-static inline void * get_ba_ptr(struct chmap * map, size_t index) {
-    return ((char*)map->backing_array) + index * map->isize;
+static inline void * entry_item(struct chmap * map, struct entry * entry) {
+    if (map->flags & CHMAP_INLINE_ITEMS) {
+        return &entry->backing_array_key;
+    }
+
+    return get_ba_ptr(map, entry->backing_array_key);
 }
 
 /**
  * Creates a new, empty hashmap with the given item size and key size.
  */
 struct chmap * chmap_new(const size_t item_size, const size_t key_size) {
-    void * backing_array = calloc(DEFAULT_BACKING_ARRAY_LENGTH, sizeof(item_size));
+    return chmap_new_flags(item_size, key_size, 0);
+}
+
+struct chmap * chmap_new_flags(const size_t item_size, const size_t key_size, unsigned int flags) {
     struct chmap * map = malloc(sizeof(struct chmap));
 
+    if (item_size > CHMAP_INLINE_MAX_SIZE) {
+        flags &= ~CHMAP_INLINE_ITEMS;
+    }
+
     map->bais_idx = DEFAULT_BACKING_ARRAY_LENGTH - 1;
+    map->flags = flags;
     map->ksize = key_size;
     map->isize = item_size;
     map->used_size = 0;
     map->array_size = DEFAULT_BACKING_ARRAY_LENGTH;
     map->translation_array = init_translation_array(DEFAULT_BACKING_ARRAY_LENGTH);
-    map->bais = init_bais_stack(DEFAULT_BACKING_ARRAY_LENGTH);
-    map->backing_array = backing_array;
+
+    if (flags & CHMAP_INLINE_ITEMS) {
+        map->bais = NULL;
+        map->backing_array = NULL;
+    } else {
+        map->bais = init_bais_stack(DEFAULT_BACKING_ARRAY_LENGTH);
+        map->backing_array = calloc(DEFAULT_BACKING_ARRAY_LENGTH, item_size);
+    }
+
+    map->journal = NULL;
+    map->journal_path = NULL;
+    map->journal_records = 0;
+    map->grow_count = 0;
+    memset(&map->counters, 0, sizeof(struct chmap_counters));
+    map->grow_hook = NULL;
+    map->grow_hook_ctx = NULL;
+    map->trace = NULL;
+    map->lru = NULL;
+    map->ttl = NULL;
+    map->filter = NULL;
 
     return map;
 }
 
 /**
- * Given a map, a hash, and a pointer to an item, puts the item in the map with key `hash`.
+ * Given a map and a hash, gets the index in the translation array of the entry with key `hash`, inserting
+ * a new one with an uninitialized item if there isn't one yet. `*inserted` is set to 1 if the entry was
+ * inserted, or 0 if it was already there.
  */
-static int chmap_put_hash(
+static size_t upsert_index(
     struct chmap * map,
     const uint64_t hash,
-    const void * item
+    int * inserted
 ) {
     struct probe_sequence probe = probe_array(map, hash);
-    const struct entry looking_at = map->translation_array[probe.index];
-    const size_t itemsize = map->isize;
+    struct entry looking_at = map->translation_array[probe.index];
 
-    if (looking_at.has_entry == 0) {
-        // We found an empty spot - put it in, no fuss
-        size_t bak = pop_bais_idx(map);
-        map->used_size++;
-        struct entry new_entry = {
-            1,
-            probe.psl,
-            .backing_array_key = bak,
-            .keyword = hash,
-        };
-
-        
-        map->translation_array[probe.index] = new_entry;
+    if (looking_at.has_entry == 1 && looking_at.keyword == hash
+        && ttl_expire_if_due(map, probe.index) == map->array_size) {
+        // The key expired, so it's put again from scratch. Removing it shifted entries back, though.
+        probe = probe_array(map, hash);
+        looking_at = map->translation_array[probe.index];
+    }
 
-        void * ba_ptr = get_ba_ptr(map, bak);
+    if (looking_at.has_entry == 1 && looking_at.keyword == hash && !(map->flags & CHMAP_MULTIMAP)) {
+        // This key already is associated - hand back its item
+        *inserted = 0;
 
-        memcpy(ba_ptr, item, itemsize);
-    } else if (looking_at.keyword == hash) {
-        // This key already is associated - overwrite it
-        void * ba_ptr = get_ba_ptr(map, looking_at.backing_array_key);
+        if (map->lru != NULL) {
+            lru_touch(map->lru, looking_at.backing_array_key);
+        }
+
+        return probe.index;
+    }
+
+    if (map->lru != NULL && map->used_size >= map->lru->capacity) {
+        // Evicting shifts entries back, so the spot for the new one has to be found again.
+        lru_evict(map);
+        probe = probe_array(map, hash);
+        looking_at = map->translation_array[probe.index];
+    }
 
-        memcpy(ba_ptr, item, itemsize);
+    // Inline items live in the entry, so there is no backing array slot to take.
+    size_t bak = map->flags & CHMAP_INLINE_ITEMS ? 0 : pop_bais_idx(map);
+    map->used_size++;
+    struct entry new_entry = {
+        1,
+        probe.psl,
+        .backing_array_key = bak,
+        .keyword = hash,
+    };
 
-        return 1;
+    if (looking_at.has_entry == 0) {
+        // We found an empty spot - put it in, no fuss
+        map->translation_array[probe.index] = new_entry;
     } else {
         // We need to now swap the two out, and put the next one somewhere else down in the array.
-        size_t bak = pop_bais_idx(map);
-        map->used_size++;
-        struct entry new_entry = {
-            1,
-            probe.psl,
-            .backing_array_key = bak,
-            .keyword = hash,
-        };
+        bubble_up(map, new_entry, probe.index);
+    }
 
-        void * ba_ptr = get_ba_ptr(map, bak);
+    if (map->lru != NULL) {
+        lru_insert(map->lru, bak, hash);
+    }
 
-        memcpy(ba_ptr, item, itemsize);
+    if (map->ttl != NULL) {
+        ttl_insert(map->ttl, bak, hash);
+    }
 
-        bubble_up(map, new_entry, probe.index);
+    if (map->filter != NULL) {
+        filter_add(map->filter, hash);
     }
 
-    return 0;
+    *inserted = 1;
+
+    // Robinhood shifting never moves the new entry from where the probe stopped, only the ones after it.
+    return probe.index;
 }
 
-int chmap_put(
+/**
+ * Like `upsert_index`, but gets a pointer to the entry's item.
+ */
+static void * upsert_hash(
     struct chmap * map,
-    const void * key,
+    const uint64_t hash,
+    int * inserted
+) {
+    return entry_item(map, &map->translation_array[upsert_index(map, hash, inserted)]);
+}
+
+/**
+ * Given a map, a hash, and a pointer to an item, puts the item in the map with key `hash`.
+ */
+static int chmap_put_hash(
+    struct chmap * map,
+    const uint64_t hash,
     const void * item
 ) {
-    // This is used in place of a uint8_t[8] to provide the same 8 bytes
-    // but in a format easier to use as a key.
-    uint64_t outword;
+    int inserted;
+    void * ba_ptr = upsert_hash(map, hash, &inserted);
 
-    if (map->used_size >= map->array_size * MAX_LOAD_FACTOR) {
-        grow_map(map);
-    }
+    memcpy(ba_ptr, item, map->isize);
 
-    siphash(key, map->ksize, SIPHASH_KEY, (uint8_t*)&outword, 8);
+    return !inserted;
+}
 
-    return chmap_put_hash(map, outword, item);
+uint64_t chmap_hash(struct chmap * map, const void * key) {
+    return chmap_hash_key(key, map->ksize);
 }
 
-void * chmap_get(struct chmap * map, const void * key) {
+uint64_t chmap_hash_key(const void * key, const size_t ksize) {
+    // This is used in place of a uint8_t[8] to provide the same 8 bytes
+    // but in a format easier to use as a key.
     uint64_t outword;
 
-    siphash(key, map->ksize, SIPHASH_KEY, (uint8_t*)&outword, 8);
+    siphash(key, ksize, SIPHASH_KEY, (uint8_t*)&outword, 8);
 
-    size_t working_index = outword % map->array_size;
-
-    struct entry maybe = map->translation_array[working_index];
-    while (maybe.has_entry && maybe.keyword != outword) {
-        working_index = (working_index + 1) % map->array_size;
-        maybe = map->translation_array[working_index];
-    };
+    return outword;
+}
 
-    if (maybe.has_entry) {
-        return (get_ba_ptr(map, maybe.backing_array_key));
-    } else {
-        return NULL;
-    }
+int chmap_put(
+    struct chmap * map,
+    const void * key,
+    const void * item
+) {
+    return chmap_put_hashed(map, chmap_hash(map, key), item);
 }
 
+int chmap_put_hashed(
+    struct chmap * map,
+    const uint64_t hash,
+    const void * item
+) {
+    const uint64_t start = map->trace != NULL ? clock_ns() : 0;
+    const size_t grow_count = map->grow_count;
 
-void chmap_del(struct chmap * map, const void * key) {
-    uint64_t outword;
+    if (map->used_size >= map->array_size * MAX_LOAD_FACTOR) {
+        grow_map(map);
+    }
 
-    siphash(key, map->ksize, SIPHASH_KEY, (uint8_t*)&outword, 8);
+    int overwritten = chmap_put_hash(map, hash, item);
 
-    size_t working_index = outword % map->array_size;
-    struct entry removing_entry = map->translation_array[working_index];
-    struct entry next;
+    journal_record(map, JOURNAL_OP_PUT, hash, item);
 
-    push_bais_idx(map, removing_entry.backing_array_key);
+    if (map->trace != NULL) {
+        const uint64_t elapsed = clock_ns() - start;
 
-    do {
-        size_t cur = working_index;
-        working_index = (working_index + 1) % map->array_size;
-        next = map->translation_array[working_index];
+        histogram_record(&map->trace->put, elapsed);
 
-        next.psl--;
+        if (map->grow_count != grow_count) {
+            histogram_record(&map->trace->growing_put, elapsed);
+        }
+    }
 
-        map->translation_array[cur] = next;
-    } while (next.has_entry);
+    return overwritten;
+}
 
-    map->used_size--;
+void * chmap_upsert(struct chmap * map, const void * key, int * inserted) {
+    return chmap_upsert_hashed(map, chmap_hash(map, key), inserted);
+}
+
+void * chmap_upsert_hashed(struct chmap * map, const uint64_t hash, int * inserted) {
+    int was_inserted;
+
+    if (map->used_size >= map->array_size * MAX_LOAD_FACTOR) {
+        grow_map(map);
+    }
+
+    void * item = upsert_hash(map, hash, &was_inserted);
+
+    if (was_inserted) {
+        memset(item, 0, map->isize);
+    }
+
+    if (inserted != NULL) {
+        *inserted = was_inserted;
+    }
+
+    return item;
+}
+
+void * chmap_get(struct chmap * map, const void * key) {
+    return chmap_get_hashed(map, chmap_hash(map, key));
+}
+
+void * chmap_get_hashed(struct chmap * map, const uint64_t hash) {
+    const uint64_t start = map->trace != NULL ? clock_ns() : 0;
+    size_t index = find_hash(map, hash);
+    void * item = NULL;
+
+    STAT_ADD(map, gets, 1);
+    STAT_FILTER_LOOKUP(map, hash, index);
+
+    // An expired entry is removed by the first get that finds it, and counts as missing.
+    index = ttl_expire_if_due(map, index);
+
+    if (index != map->array_size) {
+        STAT_ADD(map, hits, 1);
+        item = entry_item(map, &map->translation_array[index]);
+
+        if (map->lru != NULL) {
+            lru_touch(map->lru, map->translation_array[index].backing_array_key);
+        }
+
+        // CLOCK maps don't count hits or misses, so that a get writes nothing but a reference bit.
+        if (map->lru != NULL && map->lru->policy == CHMAP_EVICT_LRU) {
+            map->lru->counters.hits++;
+        }
+    } else {
+        STAT_ADD(map, misses, 1);
+
+        if (map->lru != NULL && map->lru->policy == CHMAP_EVICT_LRU) {
+            map->lru->counters.misses++;
+        }
+    }
+
+    if (map->trace != NULL) {
+        histogram_record(&map->trace->get, clock_ns() - start);
+    }
+
+    return item;
+}
+
+
+size_t chmap_get_all(
+    struct chmap * map,
+    const void * key,
+    void (*each)(void * item, void * ctx),
+    void * ctx
+) {
+    return chmap_get_all_hashed(map, chmap_hash(map, key), each, ctx);
+}
+
+size_t chmap_get_all_hashed(
+    struct chmap * map,
+    const uint64_t hash,
+    void (*each)(void * item, void * ctx),
+    void * ctx
+) {
+    size_t index = hash % map->array_size;
+    size_t psl = 0;
+    size_t found = 0;
+
+    // Same walk as `find_hash`, but through the whole run of entries that share the hash's home.
+    while (map->translation_array[index].has_entry && map->translation_array[index].psl >= psl) {
+        if (map->translation_array[index].keyword == hash) {
+            // Maps with expiry are never multimaps, so an expired item is the only one under the key.
+            if (ttl_expire_if_due(map, index) == map->array_size) {
+                break;
+            }
+
+            each(entry_item(map, &map->translation_array[index]), ctx);
+            found++;
+        }
+
+        index = (index + 1) % map->array_size;
+        psl++;
+    }
+
+    return found;
+}
+
+static void count_item(void * item, void * ctx) {
+    (void)item;
+    (void)ctx;
+}
+
+size_t chmap_count(struct chmap * map, const void * key) {
+    return chmap_get_all(map, key, count_item, NULL);
+}
+
+void chmap_del(struct chmap * map, const void * key) {
+    chmap_del_hashed(map, chmap_hash(map, key));
+}
+
+void chmap_del_hashed(struct chmap * map, const uint64_t hash) {
+    const uint64_t start = map->trace != NULL ? clock_ns() : 0;
+
+    if (chmap_del_hash(map, hash)) {
+        journal_record(map, JOURNAL_OP_DEL, hash, NULL);
+    }
+
+    if (map->trace != NULL) {
+        histogram_record(&map->trace->del, clock_ns() - start);
+    }
+}
+
+int chmap_take(struct chmap * map, const void * key, void * out_item) {
+    return chmap_take_hashed(map, chmap_hash(map, key), out_item);
+}
+
+int chmap_take_hashed(struct chmap * map, const uint64_t hash, void * out_item) {
+    size_t index = ttl_expire_if_due(map, find_hash(map, hash));
+
+    if (index == map->array_size) {
+        return 0;
+    }
+
+    if (out_item != NULL) {
+        memcpy(out_item, entry_item(map, &map->translation_array[index]), map->isize);
+    }
+
+    remove_entry(map, index);
+    journal_record(map, JOURNAL_OP_DEL, hash, NULL);
+
+    return 1;
+}
+
+void chmap_stats(struct chmap * map, struct chmap_stats * out) {
+    size_t psl_total = 0;
+
+    memset(out, 0, sizeof(struct chmap_stats));
+
+    for (size_t i = 0; i < map->array_size; i++) {
+        struct entry entry = map->translation_array[i];
+
+        if (!entry.has_entry) {
+            continue;
+        }
+
+        const size_t bucket = entry.psl < CHMAP_PSL_HISTOGRAM_LENGTH ? entry.psl : CHMAP_PSL_HISTOGRAM_LENGTH - 1;
+
+        out->psl_histogram[bucket]++;
+        psl_total += entry.psl;
+
+        if (entry.psl > out->max_psl) {
+            out->max_psl = entry.psl;
+        }
+    }
+
+    out->used_size = map->used_size;
+    out->array_size = map->array_size;
+    out->load_factor = (double)map->used_size / map->array_size;
+    out->mean_psl = map->used_size > 0 ? (double)psl_total / map->used_size : 0.0;
+    out->grow_count = map->grow_count;
+    out->translation_array_bytes = map->array_size * sizeof(struct entry);
+    out->backing_array_bytes = map->backing_array != NULL ? map->array_size * map->isize : 0;
+    out->bais_bytes = map->bais != NULL ? map->array_size * sizeof(size_t) : 0;
+    out->lru_bytes = map->lru != NULL ? map->array_size * lru_slot_bytes(map->lru->policy) : 0;
+    out->ttl_bytes = map->ttl != NULL ? map->array_size * (2 * sizeof(uint64_t) + 2 * sizeof(size_t) + 1) : 0;
+    out->filter_bytes = map->filter != NULL ? map->filter->block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t) : 0;
+    out->counters = map->counters;
 }
 
 void chmap_free(struct chmap * map) {
+    chmap_journal_close(map);
+    free(map->trace);
+    lru_free(map->lru);
+    ttl_free(map->ttl);
+    filter_free(map->filter);
     free(map->bais);
     free(map->translation_array);
     free(map->backing_array);
     free(map);
 }
 
+void chmap_reserve(struct chmap * map, const size_t additional) {
+    size_t new_size = map->array_size;
+
+    while (map->used_size + additional >= new_size * MAX_LOAD_FACTOR) {
+        new_size *= ARRAY_GROW_FACTOR;
+    }
+
+    if (new_size != map->array_size) {
+        resize_map(map, new_size);
+    }
+}
+
+int chmap_merge(
+    struct chmap * dst,
+    struct chmap * src,
+    const enum chmap_merge_policy policy,
+    void (*combine)(void * dst_item, const void * src_item, void * ctx),
+    void * ctx
+) {
+    if (dst->isize != src->isize || dst->ksize != src->ksize) {
+        return -1;
+    }
+
+    if (policy == CHMAP_MERGE_COMBINE && combine == NULL) {
+        return -1;
+    }
+
+    // Reserving for every entry of src would double the size of dst when the two mostly share keys,
+    // so only reserve for all of them when dst starts out empty, and for half of them otherwise. Bounded
+    // maps are already sized for their capacity, and evict instead of growing past it.
+    if (dst->lru == NULL) {
+        chmap_reserve(dst, dst->used_size == 0 ? src->used_size : (src->used_size + 1) / 2);
+    }
+
+    for (size_t i = 0; i < src->array_size; i++) {
+        struct entry entry = src->translation_array[i];
+
+        // Expired entries of src are skipped rather than removed, since removing them would shift this walk.
+        if (!entry.has_entry || (src->ttl != NULL && ttl_due(src, i))) {
+            continue;
+        }
+
+        void * src_item = entry_item(src, &src->translation_array[i]);
+        // Merging into a multimap adds every item, as though none of the keys matched. Expired entries
+        // of dst are removed first, so that the item starts over instead of combining into a dead one.
+        size_t index = dst->flags & CHMAP_MULTIMAP
+            ? dst->array_size
+            : ttl_expire_if_due(dst, find_hash(dst, entry.keyword));
+
+        if (index == dst->array_size) {
+            if (dst->used_size >= dst->array_size * MAX_LOAD_FACTOR) {
+                grow_map(dst);
+            }
+
+            chmap_put_hash(dst, entry.keyword, src_item);
+            journal_append(dst, JOURNAL_OP_PUT, entry.keyword, src_item);
+            continue;
+        }
+
+        void * dst_item = entry_item(dst, &dst->translation_array[index]);
+
+        switch (policy) {
+            case CHMAP_MERGE_OVERWRITE:
+                memcpy(dst_item, src_item, dst->isize);
+                break;
+            case CHMAP_MERGE_KEEP:
+                continue;
+            case CHMAP_MERGE_COMBINE:
+                combine(dst_item, src_item, ctx);
+                break;
+        }
+
+        journal_append(dst, JOURNAL_OP_PUT, entry.keyword, dst_item);
+    }
+
+    journal_commit(dst);
+
+    return 0;
+}
+
+void chmap_clear(struct chmap * map) {
+    if (map->used_size < map->array_size * CLEAR_SPARSE_LOAD_FACTOR) {
+        // Few entries: only touch the occupied slots, and hand their backing array slots back one by one.
+        for (size_t i = 0; map->used_size > 0; i++) {
+            struct entry entry = map->translation_array[i];
+
+            if (entry.has_entry) {
+                if (!(map->flags & CHMAP_INLINE_ITEMS)) {
+                    push_bais_idx(map, entry.backing_array_key);
+                }
+
+                map->translation_array[i].has_entry = 0;
+                map->used_size--;
+            }
+        }
+    } else {
+        // Many entries: wiping everything in one go is cheaper than checking slot by slot.
+        memset(map->translation_array, 0, map->array_size * sizeof(struct entry));
+
+        if (map->bais != NULL) {
+            fill_bais_stack(map->bais, map->array_size);
+        }
+
+        map->bais_idx = map->array_size - 1;
+        map->used_size = 0;
+    }
+
+    if (map->lru != NULL) {
+        lru_clear(map->lru, map->array_size);
+    }
+
+    if (map->ttl != NULL) {
+        ttl_clear(map->ttl, map->array_size);
+    }
+
+    if (map->filter != NULL) {
+        filter_clear(map->filter);
+    }
+
+    if (map->journal != NULL) {
+        // An empty map compacts to a journal with no records, which is cheaper than logging each delete.
+        chmap_journal_compact(map);
+    }
+}
+
+size_t chmap_retain(
+    struct chmap * map,
+    int (*keep)(const void * item, void * ctx),
+    void * ctx
+) {
+    const size_t size = map->array_size;
+    size_t start = 0;
+    size_t removed = 0;
+
+    // Start the sweep at an empty spot, so that no cluster wraps around from the end of the sweep to
+    // its start. Indices below are "unwrapped", counting up from `start` past the end of the array.
+    while (map->translation_array[start].has_entry) {
+        start++;
+    }
+
+    // Where the next kept entry goes, if it can move back that far: right after the last kept entry of
+    // its cluster.
+    size_t next = start + 1;
+
+    for (size_t unwrapped = start + 1; unwrapped <= start + size; unwrapped++) {
+        const size_t index = unwrapped % size;
+        struct entry entry = map->translation_array[index];
+
+        if (!entry.has_entry) {
+            next = unwrapped + 1;
+            continue;
+        }
+
+        map->translation_array[index].has_entry = 0;
+
+        if (!keep(entry_item(map, &entry), ctx)) {
+            if (!(map->flags & CHMAP_INLINE_ITEMS)) {
+                push_bais_idx(map, entry.backing_array_key);
+            }
+
+            if (map->lru != NULL) {
+                lru_remove(map->lru, entry.backing_array_key);
+            }
+
+            if (map->ttl != NULL) {
+                ttl_remove(map->ttl, entry.backing_array_key);
+            }
+
+            journal_append(map, JOURNAL_OP_DEL, entry.keyword, NULL);
+            removed++;
+            continue;
+        }
+
+        // Shift the entry back over any removed ones, but never past its home.
+        const size_t home = unwrapped - entry.psl;
+        const size_t dest = home > next ? home : next;
+
+        entry.psl = dest - home;
+        map->translation_array[dest % size] = entry;
+        next = dest + 1;
+    }
+
+    map->used_size -= removed;
+
+    if (map->filter != NULL) {
+        filter_deleted(map, removed);
+    }
+
+    journal_commit(map);
+
+    return removed;
+}
+
+struct chmap * chmap_clone(struct chmap * map) {
+    struct chmap * clone = malloc(sizeof(struct chmap));
+
+    *clone = *map;
+    clone->translation_array = malloc(map->array_size * sizeof(struct entry));
+    clone->journal = NULL;
+    clone->journal_path = NULL;
+    clone->journal_records = 0;
+    clone->grow_hook = NULL;
+    clone->grow_hook_ctx = NULL;
+    clone->trace = NULL;
+    clone->lru = map->lru != NULL ? lru_clone(map->lru, map->array_size) : NULL;
+    clone->ttl = map->ttl != NULL ? ttl_clone(map->ttl, map->array_size) : NULL;
+    clone->filter = map->filter != NULL ? filter_clone(map->filter) : NULL;
+
+    memcpy(clone->translation_array, map->translation_array, map->array_size * sizeof(struct entry));
+
+    if (!(map->flags & CHMAP_INLINE_ITEMS)) {
+        clone->backing_array = malloc(map->array_size * map->isize);
+        clone->bais = malloc(map->array_size * sizeof(size_t));
+        memcpy(clone->backing_array, map->backing_array, map->array_size * map->isize);
+        memcpy(clone->bais, map->bais, map->array_size * sizeof(size_t));
+    }
+
+    return clone;
+}
+
+int chmap_copy(struct chmap * dst, struct chmap * src) {
+    if (dst->isize != src->isize || dst->ksize != src->ksize || dst->flags != src->flags) {
+        return -1;
+    }
+
+    // Bounded maps only copy into bounded maps of the same capacity and policy, so dst stays within its
+    // bound and keeps the eviction state it expects.
+    if ((dst->lru == NULL) != (src->lru == NULL)) {
+        return -1;
+    }
+
+    if (dst->lru != NULL && (dst->lru->capacity != src->lru->capacity || dst->lru->policy != src->lru->policy)) {
+        return -1;
+    }
+
+    // Likewise, expiries only copy into a map that expires entries.
+    if ((dst->ttl == NULL) != (src->ttl == NULL)) {
+        return -1;
+    }
+
+    const int inline_items = src->flags & CHMAP_INLINE_ITEMS;
+
+    if (dst->array_size != src->array_size) {
+        free(dst->translation_array);
+        free(dst->backing_array);
+        free(dst->bais);
+
+        dst->translation_array = malloc(src->array_size * sizeof(struct entry));
+        dst->backing_array = inline_items ? NULL : malloc(src->array_size * src->isize);
+        dst->bais = inline_items ? NULL : malloc(src->array_size * sizeof(size_t));
+        dst->array_size = src->array_size;
+    }
+
+    memcpy(dst->translation_array, src->translation_array, src->array_size * sizeof(struct entry));
+
+    if (!inline_items) {
+        memcpy(dst->backing_array, src->backing_array, src->array_size * src->isize);
+        memcpy(dst->bais, src->bais, src->array_size * sizeof(size_t));
+    }
+    dst->used_size = src->used_size;
+    dst->bais_idx = src->bais_idx;
+
+    if (dst->lru != NULL) {
+        // dst keeps its own counters, since they count what happened to dst.
+        const struct chmap_lru_counters counters = dst->lru->counters;
+
+        lru_free(dst->lru);
+        dst->lru = lru_clone(src->lru, src->array_size);
+        dst->lru->counters = counters;
+    }
+
+    if (dst->ttl != NULL) {
+        // dst keeps its own expiry callback.
+        void (*on_expire)(const void * item, void * ctx) = dst->ttl->on_expire;
+        void * on_expire_ctx = dst->ttl->on_expire_ctx;
+
+        ttl_free(dst->ttl);
+        dst->ttl = ttl_clone(src->ttl, src->array_size);
+        dst->ttl->on_expire = on_expire;
+        dst->ttl->on_expire_ctx = on_expire_ctx;
+    }
+
+    if (dst->filter != NULL) {
+        // dst keeps its own filter settings, but the keys it was built from are gone.
+        filter_build(dst);
+    }
+
+    if (dst->journal != NULL) {
+        // The journal has no record of what dst held before, so it needs rewriting from scratch.
+        return chmap_journal_compact(dst);
+    }
+
+    return 0;
+}
+
+/* --- journal --- */
+
+/**
+ * Writes one journal record to `journal`. `item` is only written for puts. Returns 0 on success, or -1 if
+ * the write failed.
+ */
+static int journal_write_record(
+    FILE * journal,
+    const size_t isize,
+    const char op,
+    const uint64_t hash,
+    const void * item
+) {
+    if (fputc(op, journal) == EOF || fwrite(&hash, sizeof(hash), 1, journal) != 1) {
+        return -1;
+    }
+
+    if (op == JOURNAL_OP_PUT && isize > 0 && fwrite(item, isize, 1, journal) != 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes the journal header, which records the item and key sizes so that a journal can't be replayed
+ * into a map it doesn't belong to.
+ */
+static int journal_write_header(struct chmap * map, FILE * journal) {
+    const uint64_t sizes[2] = { map->isize, map->ksize };
+
+    if (fwrite(JOURNAL_MAGIC, 4, 1, journal) != 1 || fwrite(sizes, sizeof(sizes), 1, journal) != 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Pushes everything written to `journal` out of this process. With CHMAP_JOURNAL_FSYNC, it is also
+ * pushed out of the OS cache and onto the disk.
+ */
+static int journal_sync(FILE * journal) {
+    if (fflush(journal) != 0) {
+        return -1;
+    }
+
+    #ifdef CHMAP_JOURNAL_FSYNC
+    if (fsync(fileno(journal)) != 0) {
+        return -1;
+    }
+    #endif
+
+    return 0;
+}
+
+/**
+ * Appends a record to the map's journal, if it has one, without syncing it. Bulk operations append
+ * all of their records and then commit them together.
+ */
+static void journal_append(struct chmap * map, const char op, const uint64_t hash, const void * item) {
+    if (map->journal == NULL) {
+        return;
+    }
+
+    journal_write_record(map->journal, map->isize, op, hash, item);
+    map->journal_records++;
+}
+
+/**
+ * Syncs the map's journal, if it has one. Once the journal holds a lot more records than the map holds
+ * entries, it is compacted so it doesn't grow without bound.
+ */
+static void journal_commit(struct chmap * map) {
+    if (map->journal == NULL) {
+        return;
+    }
+
+    journal_sync(map->journal);
+
+    if (map->journal_records > JOURNAL_COMPACT_FACTOR * (map->used_size + DEFAULT_BACKING_ARRAY_LENGTH)) {
+        chmap_journal_compact(map);
+    }
+}
+
+/**
+ * Appends a record to the map's journal, if it has one, and commits it.
+ */
+static void journal_record(struct chmap * map, const char op, const uint64_t hash, const void * item) {
+    journal_append(map, op, hash, item);
+    journal_commit(map);
+}
+
+/**
+ * Replays every record in `journal` into the map. Returns 1 if the journal ended cleanly, 0 if it ended
+ * in a torn or unreadable record (such as one whose writer died halfway through appending it), or -1 if
+ * the journal was written by a map with a different item or key size.
+ */
+static int journal_replay(struct chmap * map, FILE * journal) {
+    char magic[4];
+    uint64_t sizes[2];
+
+    if (fread(magic, 4, 1, journal) != 1 || fread(sizes, sizeof(sizes), 1, journal) != 1) {
+        return 0;
+    }
+
+    if (memcmp(magic, JOURNAL_MAGIC, 4) != 0 || sizes[0] != map->isize || sizes[1] != map->ksize) {
+        return -1;
+    }
+
+    void * item = malloc(map->isize > 0 ? map->isize : 1);
+    int clean = 1;
+    int op;
+
+    while ((op = fgetc(journal)) != EOF) {
+        uint64_t hash;
+
+        if (fread(&hash, sizeof(hash), 1, journal) != 1) {
+            clean = 0;
+            break;
+        }
+
+        if (op == JOURNAL_OP_PUT) {
+            if (map->isize > 0 && fread(item, map->isize, 1, journal) != 1) {
+                clean = 0;
+                break;
+            }
+
+            if (map->used_size >= map->array_size * MAX_LOAD_FACTOR) {
+                grow_map(map);
+            }
+
+            chmap_put_hash(map, hash, item);
+        } else if (op == JOURNAL_OP_DEL) {
+            chmap_del_hash(map, hash);
+        } else {
+            clean = 0;
+            break;
+        }
+
+        map->journal_records++;
+    }
+
+    free(item);
+
+    return clean;
+}
+
+int chmap_journal_open(struct chmap * map, const char * path) {
+    chmap_journal_close(map);
+
+    // A delete record can't say which of a key's items it removed, so multimaps can't be replayed.
+    // Records don't hold expiries either, so replaying into a map with expiry would bring back entries
+    // that never expire.
+    if (map->flags & CHMAP_MULTIMAP || map->ttl != NULL) {
+        return -1;
+    }
+
+    const int had_entries = map->used_size > 0;
+    int clean = 0;
+
+    FILE * existing = fopen(path, "rb");
+
+    if (existing != NULL) {
+        clean = journal_replay(map, existing);
+        fclose(existing);
+
+        if (clean < 0) {
+            return -1;
+        }
+    }
+
+    map->journal_path = malloc(strlen(path) + 1);
+    strcpy(map->journal_path, path);
+
+    if (!clean || had_entries) {
+        // Either there's no usable journal yet, it ends in a torn record that appends can't follow,
+        // or the map has entries the journal doesn't know about. All are fixed by writing a fresh one.
+        return chmap_journal_compact(map);
+    }
+
+    map->journal = fopen(path, "ab");
+
+    if (map->journal == NULL) {
+        chmap_journal_close(map);
+        return -1;
+    }
+
+    return 0;
+}
+
+int chmap_journal_compact(struct chmap * map) {
+    if (map->journal_path == NULL) {
+        return -1;
+    }
+
+    const size_t path_len = strlen(map->journal_path);
+    char * tmp_path = malloc(path_len + sizeof(".tmp"));
+    memcpy(tmp_path, map->journal_path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", sizeof(".tmp"));
+
+    FILE * tmp = fopen(tmp_path, "wb");
+    int ok = tmp != NULL && journal_write_header(map, tmp) == 0;
+
+    for (size_t i = 0; ok && i < map->array_size; i++) {
+        struct entry entry = map->translation_array[i];
+
+        if (entry.has_entry) {
+            void * ba_ptr = entry_item(map, &map->translation_array[i]);
+            ok = journal_write_record(tmp, map->isize, JOURNAL_OP_PUT, entry.keyword, ba_ptr) == 0;
+        }
+    }
+
+    ok = ok && journal_sync(tmp) == 0;
+
+    if (tmp != NULL && fclose(tmp) != 0) {
+        ok = 0;
+    }
+
+    if (map->journal != NULL) {
+        fclose(map->journal);
+        map->journal = NULL;
+    }
+
+    // The rename is what makes compaction atomic: a crash before it leaves the old journal in place.
+    if (!ok || rename(tmp_path, map->journal_path) != 0) {
+        remove(tmp_path);
+        free(tmp_path);
+        map->journal = fopen(map->journal_path, "ab");
+        return -1;
+    }
+
+    free(tmp_path);
+
+    map->journal = fopen(map->journal_path, "ab");
+    map->journal_records = map->used_size;
+
+    return map->journal == NULL ? -1 : 0;
+}
+
+int chmap_journal_close(struct chmap * map) {
+    int ret = 0;
+
+    if (map->journal != NULL) {
+        if (ferror(map->journal) || journal_sync(map->journal) != 0) {
+            ret = -1;
+        }
+
+        if (fclose(map->journal) != 0) {
+            ret = -1;
+        }
+    }
+
+    free(map->journal_path);
+    map->journal = NULL;
+    map->journal_path = NULL;
+    map->journal_records = 0;
+
+    return ret;
+}
+
+/* --- frozen maps --- */
+
+/**
+ * A strong 64-bit mixer (the murmur3 finalizer), used to derive the independent-looking hashes
+ * that bucket and place keys in a frozen map.
+ */
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+
+    return x;
+}
+
+/**
+ * Gets the bucket of `hash`. Like PTHash, this is skewed so that most keys land in the first few buckets.
+ * Those dense buckets are placed while the table is still mostly empty, which leaves only small buckets
+ * to place once it is nearly full.
+ */
+static inline size_t frozen_bucket(const struct chmap_frozen * frozen, const uint64_t hash) {
+    const uint64_t mixed = mix64(hash ^ frozen->seed);
+    const size_t dense_buckets = frozen->dense_bucket_count;
+
+    if (mixed % 10 < 6) {
+        return (mixed / 10) % dense_buckets;
+    }
+
+    return dense_buckets + (mixed / 10) % (frozen->bucket_count - dense_buckets);
+}
+
+/**
+ * Gets the position of a key in the (not yet remapped) table, given `mix64(hash + seed)` for the key and
+ * `mix64(pilot + seed)` for the pilot of its bucket. Both are passed premixed so that freezing can reuse
+ * them across the many pilots it tries. They're mixed once more after combining: otherwise the pilot would
+ * only permute the bits that pick a position, and keys that collide would collide under every pilot.
+ */
+static inline size_t frozen_position(
+    const struct chmap_frozen * frozen,
+    const uint64_t mixed_hash,
+    const uint64_t mixed_pilot
+) {
+    const uint64_t mixed = mix64(mixed_hash ^ mixed_pilot);
+
+    if (frozen->table_size <= UINT32_MAX) {
+        // Scales the top 32 bits into the table with a multiply, which is much cheaper than a modulo.
+        return (size_t)(((mixed >> 32) * frozen->table_size) >> 32);
+    }
+
+    return mixed % frozen->table_size;
+}
+
+/**
+ * Tries to find a pilot for every bucket so that no two keys share a position, using the current seed.
+ * Buckets are placed largest first, while the table is still empty. Returns 0 if some bucket ran out of
+ * pilots, in which case the caller should retry with a different seed.
+ */
+static int frozen_place(
+    struct chmap_frozen * frozen,
+    const uint64_t * hashes,
+    size_t * positions,
+    uint64_t * taken
+) {
+    const size_t n = frozen->size;
+    const size_t bucket_count = frozen->bucket_count;
+
+    size_t * bucket_starts = calloc(bucket_count + 1, sizeof(size_t));
+    size_t * members = malloc((n > 0 ? n : 1) * sizeof(size_t));
+    size_t * order = malloc(bucket_count * sizeof(size_t));
+    uint64_t * mixed_hashes = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    size_t max_bucket = 0;
+    int ok = 1;
+
+    // Counting sort the keys by bucket.
+    for (size_t i = 0; i < n; i++) {
+        bucket_starts[frozen_bucket(frozen, hashes[i]) + 1]++;
+    }
+
+    for (size_t b = 0; b < bucket_count; b++) {
+        if (bucket_starts[b + 1] > max_bucket) {
+            max_bucket = bucket_starts[b + 1];
+        }
+
+        bucket_starts[b + 1] += bucket_starts[b];
+    }
+
+    size_t * fill = malloc(bucket_count * sizeof(size_t));
+    memcpy(fill, bucket_starts, bucket_count * sizeof(size_t));
+
+    for (size_t i = 0; i < n; i++) {
+        members[fill[frozen_bucket(frozen, hashes[i])]++] = i;
+        mixed_hashes[i] = mix64(hashes[i] + frozen->seed);
+    }
+
+    // Then counting sort the buckets by size, largest first.
+    size_t * size_starts = calloc(max_bucket + 2, sizeof(size_t));
+
+    for (size_t b = 0; b < bucket_count; b++) {
+        size_starts[max_bucket - (bucket_starts[b + 1] - bucket_starts[b]) + 1]++;
+    }
+
+    for (size_t s = 0; s <= max_bucket; s++) {
+        size_starts[s + 1] += size_starts[s];
+    }
+
+    for (size_t b = 0; b < bucket_count; b++) {
+        order[size_starts[max_bucket - (bucket_starts[b + 1] - bucket_starts[b])]++] = b;
+    }
+
+    for (size_t o = 0; ok && o < bucket_count; o++) {
+        const size_t b = order[o];
+        const size_t start = bucket_starts[b];
+        const size_t end = bucket_starts[b + 1];
+        size_t pilot;
+
+        if (start == end) {
+            // Buckets are sorted by size, so every bucket after this one is empty too.
+            break;
+        }
+
+        for (pilot = 0; pilot <= FROZEN_MAX_PILOT; pilot++) {
+            const uint64_t mixed_pilot = mix64(pilot + frozen->seed);
+            size_t placed = start;
+
+            for (; placed < end; placed++) {
+                const size_t position = frozen_position(frozen, mixed_hashes[members[placed]], mixed_pilot);
+
+                if (BIT_GET(taken, position)) {
+                    break;
+                }
+
+                // Mark as we go, so keys within the bucket can't collide with each other.
+                BIT_SET(taken, position);
+                positions[members[placed]] = position;
+            }
+
+            if (placed == end) {
+                break;
+            }
+
+            for (size_t undo = start; undo < placed; undo++) {
+                BIT_CLEAR(taken, positions[members[undo]]);
+            }
+        }
+
+        if (pilot > FROZEN_MAX_PILOT) {
+            ok = 0;
+        } else {
+            frozen->pilots[b] = (uint16_t)pilot;
+        }
+    }
+
+    free(size_starts);
+    free(mixed_hashes);
+    free(fill);
+    free(order);
+    free(members);
+    free(bucket_starts);
+
+    return ok;
+}
+
+struct chmap_frozen * chmap_freeze(struct chmap * map) {
+    const size_t n = map->used_size;
+
+    // Entries with the same hash would always collide, so no perfect hash exists for a multimap.
+    if (map->flags & CHMAP_MULTIMAP) {
+        return NULL;
+    }
+
+    struct chmap_frozen * frozen = malloc(sizeof(struct chmap_frozen));
+    frozen->isize = map->isize;
+    frozen->ksize = map->ksize;
+    frozen->size = n;
+    frozen->table_size = n + n / FROZEN_SPARE_DIVISOR + 1;
+    frozen->bucket_count = n / FROZEN_BUCKET_SIZE + 2;
+    frozen->dense_bucket_count = frozen->bucket_count * 3 / 10 + 1;
+    frozen->slot_size = sizeof(uint64_t) + (map->isize + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+    frozen->pilots = calloc(frozen->bucket_count, sizeof(uint16_t));
+    frozen->remap = calloc(frozen->table_size - n, sizeof(size_t));
+    frozen->slots = malloc(n > 0 ? n * frozen->slot_size : 1);
+
+    uint64_t * hashes = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    void ** items = malloc((n > 0 ? n : 1) * sizeof(void *));
+    size_t * positions = malloc((n > 0 ? n : 1) * sizeof(size_t));
+    const size_t taken_words = (frozen->table_size + 63) / 64;
+    uint64_t * taken = malloc(taken_words * sizeof(uint64_t));
+    size_t found = 0;
+
+    for (size_t i = 0; i < map->array_size; i++) {
+        struct entry entry = map->translation_array[i];
+
+        if (entry.has_entry) {
+            hashes[found] = entry.keyword;
+            items[found] = entry_item(map, &map->translation_array[i]);
+            found++;
+        }
+    }
+
+    int placed = 0;
+
+    for (uint64_t attempt = 0; !placed && attempt < FROZEN_SEED_ATTEMPTS; attempt++) {
+        frozen->seed = mix64(attempt + 1);
+        memset(taken, 0, taken_words * sizeof(uint64_t));
+        placed = frozen_place(frozen, hashes, positions, taken);
+    }
+
+    if (placed) {
+        // The table has a few spare positions past `n` to make placement easy. Keys that landed there
+        // are remapped into the holes below `n` that they left behind, which keeps the slots minimal.
+        size_t hole = 0;
+
+        for (size_t position = n; position < frozen->table_size; position++) {
+            if (BIT_GET(taken, position)) {
+                while (BIT_GET(taken, hole)) {
+                    hole++;
+                }
+
+                frozen->remap[position - n] = hole++;
+            }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const size_t position = positions[i] < n ? positions[i] : frozen->remap[positions[i] - n];
+            unsigned char * slot = frozen->slots + position * frozen->slot_size;
+
+            memcpy(slot, &hashes[i], sizeof(uint64_t));
+            memcpy(slot + sizeof(uint64_t), items[i], map->isize);
+        }
+    }
+
+    free(taken);
+    free(positions);
+    free(items);
+    free(hashes);
+
+    if (!placed) {
+        chmap_frozen_free(frozen);
+        return NULL;
+    }
+
+    return frozen;
+}
+
+void * chmap_frozen_get(const struct chmap_frozen * frozen, const void * key) {
+    uint64_t outword;
+
+    if (frozen->size == 0) {
+        return NULL;
+    }
+
+    siphash(key, frozen->ksize, SIPHASH_KEY, (uint8_t*)&outword, 8);
+
+    const uint64_t pilot = frozen->pilots[frozen_bucket(frozen, outword)];
+    size_t position = frozen_position(frozen, mix64(outword + frozen->seed), mix64(pilot + frozen->seed));
+
+    if (position >= frozen->size) {
+        position = frozen->remap[position - frozen->size];
+    }
+
+    unsigned char * slot = frozen->slots + position * frozen->slot_size;
+    uint64_t stored;
+    memcpy(&stored, slot, sizeof(uint64_t));
+
+    return stored == outword ? slot + sizeof(uint64_t) : NULL;
+}
+
+void chmap_frozen_free(struct chmap_frozen * frozen) {
+    free(frozen->pilots);
+    free(frozen->remap);
+    free(frozen->slots);
+    free(frozen);
+}
+
+/* --- tracing --- */
+
+/**
+ * A monotonic clock in nanoseconds, falling back on processor time where there isn't one.
+ */
+static inline uint64_t clock_ns(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)((double)clock() * 1e9 / CLOCKS_PER_SEC);
+#endif
+}
+
+static inline unsigned int msb64(uint64_t x) {
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(x);
+#else
+    unsigned int msb = 0;
+
+    while (x >>= 1) {
+        msb++;
+    }
+
+    return msb;
+#endif
+}
+
+/**
+ * Gets the bucket of a histogram that `value` is counted in.
+ */
+static inline size_t histogram_bucket(const uint64_t value) {
+    if (value < (UINT64_C(1) << CHMAP_HISTOGRAM_SUB_BITS)) {
+        return value;
+    }
+
+    const unsigned int shift = msb64(value) - CHMAP_HISTOGRAM_SUB_BITS;
+
+    return ((size_t)shift << CHMAP_HISTOGRAM_SUB_BITS) + (size_t)(value >> shift);
+}
+
+/**
+ * Gets the largest value that is counted in bucket `bucket` of a histogram.
+ */
+static uint64_t histogram_bucket_max(const size_t bucket) {
+    if (bucket < (2 << CHMAP_HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+
+    const unsigned int shift = (unsigned int)(bucket >> CHMAP_HISTOGRAM_SUB_BITS) - 1;
+    const uint64_t mantissa = bucket - ((size_t)shift << CHMAP_HISTOGRAM_SUB_BITS);
+
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static void histogram_record(struct chmap_histogram * histogram, const uint64_t value) {
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t chmap_histogram_percentile(const struct chmap_histogram * histogram, const double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    for (size_t i = 0; i < CHMAP_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+
+        if (seen >= rank) {
+            const uint64_t bucket_max = histogram_bucket_max(i);
+
+            return bucket_max < histogram->max ? bucket_max : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+void chmap_set_grow_hook(
+    struct chmap * map,
+    void (*hook)(const struct chmap_grow_event * event, void * ctx),
+    void * ctx
+) {
+    map->grow_hook = hook;
+    map->grow_hook_ctx = ctx;
+}
+
+int chmap_trace_enable(struct chmap * map) {
+    if (map->trace != NULL) {
+        return 0;
+    }
+
+    map->trace = calloc(1, sizeof(struct chmap_trace));
+
+    return map->trace != NULL ? 0 : -1;
+}
+
+void chmap_trace_disable(struct chmap * map) {
+    free(map->trace);
+    map->trace = NULL;
+}
+
+const struct chmap_trace * chmap_get_trace(struct chmap * map) {
+    return map->trace;
+}
+
+/* --- sets --- */
+
+/**
+ * Adds a hash to a set, growing it first if needed. Returns 1 if it was added, or 0 if it was already there.
+ */
+static int set_insert_hash(struct chmap * set, const uint64_t hash) {
+    int inserted;
+
+    if (set->used_size >= set->array_size * MAX_LOAD_FACTOR) {
+        grow_map(set);
+    }
+
+    upsert_hash(set, hash, &inserted);
+
+    if (inserted) {
+        journal_record(set, JOURNAL_OP_PUT, hash, NULL);
+    }
+
+    return inserted;
+}
+
+static int set_remove_hash(struct chmap * set, const uint64_t hash) {
+    if (!chmap_del_hash(set, hash)) {
+        return 0;
+    }
+
+    journal_record(set, JOURNAL_OP_DEL, hash, NULL);
+
+    return 1;
+}
+
+/**
+ * Hashes the keys `start` to `start + n` of `keys` into `hashes`, prefetching the slot each one starts
+ * probing at.
+ */
+static void hash_batch(
+    struct chmap * map,
+    const void * keys,
+    const size_t start,
+    const size_t n,
+    uint64_t * hashes
+) {
+    for (size_t i = 0; i < n; i++) {
+        hashes[i] = chmap_hash(map, (const char *)keys + (start + i) * map->ksize);
+        PREFETCH(&map->translation_array[hashes[i] % map->array_size]);
+
+        if (map->filter != NULL) {
+            PREFETCH(filter_block(map->filter, hashes[i]));
+        }
+    }
+}
+
+struct chmap * chmap_set_new(const size_t key_size) {
+    return chmap_new_flags(0, key_size, CHMAP_INLINE_ITEMS);
+}
+
+int chmap_set_insert(struct chmap * set, const void * key) {
+    return set_insert_hash(set, chmap_hash(set, key));
+}
+
+int chmap_set_contains(struct chmap * set, const void * key) {
+    const uint64_t hash = chmap_hash(set, key);
+    const size_t index = find_hash(set, hash);
+
+    STAT_FILTER_LOOKUP(set, hash, index);
+
+    return index != set->array_size;
+}
+
+int chmap_set_remove(struct chmap * set, const void * key) {
+    return set_remove_hash(set, chmap_hash(set, key));
+}
+
+size_t chmap_set_insert_many(struct chmap * set, const void * keys, const size_t count) {
+    uint64_t hashes[BATCH_SIZE];
+    size_t inserted = 0;
+
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        const size_t n = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+
+        hash_batch(set, keys, start, n, hashes);
+
+        for (size_t i = 0; i < n; i++) {
+            inserted += set_insert_hash(set, hashes[i]);
+        }
+    }
+
+    return inserted;
+}
+
+size_t chmap_set_contains_many(struct chmap * set, const void * keys, const size_t count, unsigned char * found) {
+    uint64_t hashes[BATCH_SIZE];
+    size_t total = 0;
+
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        const size_t n = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+
+        hash_batch(set, keys, start, n, hashes);
+
+        for (size_t i = 0; i < n; i++) {
+            const size_t index = find_hash(set, hashes[i]);
+            const int contains = index != set->array_size;
+
+            STAT_FILTER_LOOKUP(set, hashes[i], index);
+
+            if (found != NULL) {
+                found[start + i] = (unsigned char)contains;
+            }
+
+            total += contains;
+        }
+    }
+
+    return total;
+}
+
+size_t chmap_set_remove_many(struct chmap * set, const void * keys, const size_t count) {
+    uint64_t hashes[BATCH_SIZE];
+    size_t removed = 0;
+
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        const size_t n = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+
+        hash_batch(set, keys, start, n, hashes);
+
+        for (size_t i = 0; i < n; i++) {
+            removed += set_remove_hash(set, hashes[i]);
+        }
+    }
+
+    return removed;
+}
+
+/* --- numeric accumulation --- */
+
+/**
+ * Gets the number stored under `hash`, inserting a zero first if there isn't one, and counts the insert
+ * in `inserted`.
+ */
+static void * add_item(struct chmap * map, const uint64_t hash, size_t * inserted) {
+    int was_inserted;
+
+    assert(!(map->flags & CHMAP_MULTIMAP));
+
+    void * item = chmap_upsert_hashed(map, hash, &was_inserted);
+
+    *inserted += was_inserted;
+
+    return item;
+}
+
+static uint64_t add_u64_hash(struct chmap * map, const uint64_t hash, const uint64_t delta, size_t * inserted) {
+    uint64_t * item = add_item(map, hash, inserted);
+
+    *item += delta;
+    journal_record(map, JOURNAL_OP_PUT, hash, item);
+
+    return *item;
+}
+
+static int64_t add_i64_hash(struct chmap * map, const uint64_t hash, const int64_t delta, size_t * inserted) {
+    int64_t * item = add_item(map, hash, inserted);
+
+    // Wrap around on overflow instead of relying on signed overflow.
+    *item = (int64_t)((uint64_t)*item + (uint64_t)delta);
+    journal_record(map, JOURNAL_OP_PUT, hash, item);
+
+    return *item;
+}
+
+static double add_f64_hash(struct chmap * map, const uint64_t hash, const double delta, size_t * inserted) {
+    double * item = add_item(map, hash, inserted);
+
+    *item += delta;
+    journal_record(map, JOURNAL_OP_PUT, hash, item);
+
+    return *item;
+}
+
+uint64_t chmap_add_u64(struct chmap * map, const void * key, const uint64_t delta) {
+    size_t inserted = 0;
+
+    assert(map->isize == sizeof(uint64_t));
+
+    return add_u64_hash(map, chmap_hash(map, key), delta, &inserted);
+}
+
+int64_t chmap_add_i64(struct chmap * map, const void * key, const int64_t delta) {
+    size_t inserted = 0;
+
+    assert(map->isize == sizeof(int64_t));
+
+    return add_i64_hash(map, chmap_hash(map, key), delta, &inserted);
+}
+
+double chmap_add_f64(struct chmap * map, const void * key, const double delta) {
+    size_t inserted = 0;
+
+    assert(map->isize == sizeof(double));
+
+    return add_f64_hash(map, chmap_hash(map, key), delta, &inserted);
+}
+
+size_t chmap_add_many(
+    struct chmap * map,
+    const void * keys,
+    const void * deltas,
+    const size_t count,
+    const enum chmap_number_type type
+) {
+    uint64_t hashes[BATCH_SIZE];
+    size_t inserted = 0;
+
+    assert(map->isize == sizeof(uint64_t));
+
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        const size_t n = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+
+        hash_batch(map, keys, start, n, hashes);
+
+        for (size_t i = 0; i < n; i++) {
+            switch (type) {
+                case CHMAP_U64:
+                    add_u64_hash(map, hashes[i], ((const uint64_t *)deltas)[start + i], &inserted);
+                    break;
+                case CHMAP_I64:
+                    add_i64_hash(map, hashes[i], ((const int64_t *)deltas)[start + i], &inserted);
+                    break;
+                case CHMAP_F64:
+                    add_f64_hash(map, hashes[i], ((const double *)deltas)[start + i], &inserted);
+                    break;
+            }
+        }
+    }
+
+    return inserted;
+}
+
+#ifdef __GNUC__
+/**
+ * Gets the item stored under `key`, or NULL if there isn't one. The map is only modified if the entry
+ * has expired, in which case it's removed.
+ */
+static void * atomic_item(struct chmap * map, const void * key) {
+    const size_t index = ttl_expire_if_due(map, find_hash(map, chmap_hash(map, key)));
+
+    assert(map->isize == sizeof(uint64_t));
+
+    return index != map->array_size ? entry_item(map, &map->translation_array[index]) : NULL;
+}
+
+int chmap_atomic_add_u64(struct chmap * map, const void * key, const uint64_t delta) {
+    uint64_t * item = atomic_item(map, key);
+
+    if (item == NULL) {
+        return 0;
+    }
+
+    __atomic_fetch_add(item, delta, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+int chmap_atomic_add_i64(struct chmap * map, const void * key, const int64_t delta) {
+    // Two's complement addition is the same for both, and unsigned atomics wrap without overflowing.
+    return chmap_atomic_add_u64(map, key, (uint64_t)delta);
+}
+
+int chmap_atomic_add_f64(struct chmap * map, const void * key, const double delta) {
+    uint64_t * item = atomic_item(map, key);
+    uint64_t expected, desired;
+    double value;
+
+    if (item == NULL) {
+        return 0;
+    }
+
+    // There's no atomic floating point add, so swap in the sum until no other thread got there first.
+    expected = __atomic_load_n(item, __ATOMIC_RELAXED);
+
+    do {
+        memcpy(&value, &expected, sizeof(double));
+        value += delta;
+        memcpy(&desired, &value, sizeof(double));
+    } while (!__atomic_compare_exchange_n(item, &expected, desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return 1;
+}
+#endif
+
+/* --- joins --- */
+
+/**
+ * Which partition of a join a hash goes to. The top bits are used, since the bottom ones pick home slots
+ * within each partition.
+ */
+static size_t join_partition(const struct chmap_join * join, const uint64_t hash) {
+    return (size_t)(hash >> 32) & (join->partition_count - 1);
+}
+
+struct chmap_join * chmap_join_build(
+    const void * keys,
+    const size_t count,
+    const size_t key_size,
+    size_t partitions
+) {
+    if (partitions == 0) {
+        // Every row takes a slot, with room for the load factor. Row indices are stored in the slots.
+        partitions = count * 2 * sizeof(struct entry) / CHMAP_JOIN_CACHE_SIZE + 1;
+
+        if (partitions > JOIN_MAX_PARTITIONS) {
+            partitions = JOIN_MAX_PARTITIONS;
+        }
+    }
+
+    struct chmap_join * join = malloc(sizeof(struct chmap_join));
+
+    join->partition_count = 1;
+
+    while (join->partition_count < partitions) {
+        join->partition_count *= 2;
+    }
+
+    join->partitions = malloc(join->partition_count * sizeof(struct chmap *));
+
+    for (size_t p = 0; p < join->partition_count; p++) {
+        join->partitions[p] = chmap_new_flags(sizeof(size_t), key_size, CHMAP_MULTIMAP | CHMAP_INLINE_ITEMS);
+    }
+
+    // Hash everything up front, so that every partition can be sized before any row goes in.
+    uint64_t * hashes = malloc(count * sizeof(uint64_t));
+    size_t * sizes = calloc(join->partition_count, sizeof(size_t));
+
+    for (size_t i = 0; i < count; i++) {
+        hashes[i] = chmap_hash(join->partitions[0], (const char *)keys + i * key_size);
+        sizes[join_partition(join, hashes[i])]++;
+    }
+
+    for (size_t p = 0; p < join->partition_count; p++) {
+        chmap_reserve(join->partitions[p], sizes[p]);
+    }
+
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        const size_t n = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+
+        for (size_t i = start; i < start + n; i++) {
+            struct chmap * map = join->partitions[join_partition(join, hashes[i])];
+            PREFETCH(&map->translation_array[hashes[i] % map->array_size]);
+        }
+
+        for (size_t i = start; i < start + n; i++) {
+            chmap_put_hashed(join->partitions[join_partition(join, hashes[i])], hashes[i], &i);
+        }
+    }
+
+    free(hashes);
+    free(sizes);
+
+    return join;
+}
+
+size_t chmap_join_probe(
+    struct chmap_join * join,
+    const void * keys,
+    const size_t count,
+    struct chmap_join_cursor * cursor,
+    size_t * build_rows,
+    size_t * probe_rows,
+    const size_t capacity
+) {
+    uint64_t hashes[BATCH_SIZE];
+    const size_t ksize = join->partitions[0]->ksize;
+    size_t written = 0;
+
+    while (cursor->row < count && written < capacity) {
+        const size_t start = cursor->row;
+        const size_t n = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+
+        for (size_t i = 0; i < n; i++) {
+            hashes[i] = chmap_hash(join->partitions[0], (const char *)keys + (start + i) * ksize);
+
+            struct chmap * map = join->partitions[join_partition(join, hashes[i])];
+            PREFETCH(&map->translation_array[hashes[i] % map->array_size]);
+        }
+
+        for (size_t i = 0; i < n && written < capacity; i++) {
+            struct chmap * map = join->partitions[join_partition(join, hashes[i])];
+            size_t index = hashes[i] % map->array_size;
+            size_t psl = 0;
+            size_t skip = cursor->match;
+            int full = 0;
+
+            // Same walk as `chmap_get_all_hashed`, skipping the matches a previous call already wrote.
+            while (map->translation_array[index].has_entry && map->translation_array[index].psl >= psl) {
+                if (map->translation_array[index].keyword == hashes[i]) {
+                    if (skip > 0) {
+                        skip--;
+                    } else if (written == capacity) {
+                        full = 1;
+                        break;
+                    } else {
+                        build_rows[written] = *(size_t *)entry_item(map, &map->translation_array[index]);
+                        probe_rows[written] = start + i;
+                        written++;
+                        cursor->match++;
+                    }
+                }
+
+                index = (index + 1) % map->array_size;
+                psl++;
+            }
+
+            if (full) {
+                break;
+            }
+
+            cursor->row++;
+            cursor->match = 0;
+        }
+    }
+
+    return written;
+}
+
+void chmap_join_free(struct chmap_join * join) {
+    for (size_t p = 0; p < join->partition_count; p++) {
+        chmap_free(join->partitions[p]);
+    }
+
+    free(join->partitions);
+    free(join);
+}
+
+/* --- bounded caches --- */
+
+/**
+ * Bytes an eviction policy keeps for every slot, on top of the entry, the item and the index stack: the
+ * hash, plus either two list links or a byte of CLOCK bits.
+ */
+static size_t lru_slot_bytes(const enum chmap_evict_policy policy) {
+    return sizeof(uint64_t) + (policy == CHMAP_EVICT_LRU ? 2 * sizeof(size_t) : 1);
+}
+
+/**
+ * Takes `index` out of the recency list.
+ */
+static void lru_list_unlink(struct chmap_lru * lru, const size_t index) {
+    const size_t prev = lru->prev[index];
+    const size_t next = lru->next[index];
+
+    if (prev != LRU_NONE) {
+        lru->next[prev] = next;
+    } else {
+        lru->head = next;
+    }
+
+    if (next != LRU_NONE) {
+        lru->prev[next] = prev;
+    } else {
+        lru->tail = prev;
+    }
+}
+
+/**
+ * Puts `index` at the most recently used end of the recency list.
+ */
+static void lru_list_push_front(struct chmap_lru * lru, const size_t index) {
+    lru->prev[index] = LRU_NONE;
+    lru->next[index] = lru->head;
+
+    if (lru->head != LRU_NONE) {
+        lru->prev[lru->head] = index;
+    } else {
+        lru->tail = index;
+    }
+
+    lru->head = index;
+}
+
+/**
+ * Starts tracking a new entry, with hash `hash` and its item at `index`.
+ */
+static void lru_insert(struct chmap_lru * lru, const size_t index, const uint64_t hash) {
+    lru->keywords[index] = hash;
+
+    if (lru->policy == CHMAP_EVICT_LRU) {
+        lru_list_push_front(lru, index);
+    } else {
+        // New entries start unreferenced, so ones that are never used again are the first to go.
+        lru->clock_bits[index] = CLOCK_USED;
+    }
+}
+
+/**
+ * Stops tracking the entry with its item at `index`.
+ */
+static void lru_remove(struct chmap_lru * lru, const size_t index) {
+    if (lru->policy == CHMAP_EVICT_LRU) {
+        lru_list_unlink(lru, index);
+    } else {
+        lru->clock_bits[index] = 0;
+    }
+}
+
+/**
+ * Marks the entry with its item at `index` as just used. Under CLOCK this only writes the first time the
+ * entry is used after the hand last passed it.
+ */
+static void lru_touch(struct chmap_lru * lru, const size_t index) {
+    if (lru->policy == CHMAP_EVICT_LRU) {
+        if (lru->head != index) {
+            lru_list_unlink(lru, index);
+            lru_list_push_front(lru, index);
+        }
+    } else if (!(lru->clock_bits[index] & CLOCK_REFERENCED)) {
+        lru->clock_bits[index] |= CLOCK_REFERENCED;
+    }
+}
+
+/**
+ * Removes an entry from a full map to make room: the least recently used one, or under CLOCK, the first
+ * one the hand finds that wasn't used since it last came around. The hand clears reference bits as it
+ * passes them, so it stops within two sweeps.
+ */
+static void lru_evict(struct chmap * map) {
+    struct chmap_lru * lru = map->lru;
+    size_t index = lru->tail;
+
+    if (lru->policy == CHMAP_EVICT_CLOCK) {
+        while (lru->clock_bits[lru->hand] != CLOCK_USED) {
+            lru->clock_bits[lru->hand] &= ~CLOCK_REFERENCED;
+            lru->hand = (lru->hand + 1) % map->array_size;
+        }
+
+        index = lru->hand;
+        lru->hand = (lru->hand + 1) % map->array_size;
+    }
+
+    const uint64_t hash = lru->keywords[index];
+
+    remove_entry(map, find_hash(map, hash));
+    journal_record(map, JOURNAL_OP_DEL, hash, NULL);
+    lru->counters.evictions++;
+}
+
+/**
+ * Makes room in the eviction state for backing array indices up to `new_size`.
+ */
+static void lru_resize(struct chmap_lru * lru, const size_t old_size, const size_t new_size) {
+    lru->keywords = realloc(lru->keywords, new_size * sizeof(uint64_t));
+
+    if (lru->policy == CHMAP_EVICT_LRU) {
+        lru->prev = realloc(lru->prev, new_size * sizeof(size_t));
+        lru->next = realloc(lru->next, new_size * sizeof(size_t));
+    } else {
+        // The hand passes every index, so the new ones have to start out empty.
+        lru->clock_bits = realloc(lru->clock_bits, new_size);
+        memset(lru->clock_bits + old_size, 0, new_size - old_size);
+    }
+}
+
+/**
+ * Forgets every entry, for a map that was just cleared.
+ */
+static void lru_clear(struct chmap_lru * lru, const size_t array_size) {
+    if (lru->policy == CHMAP_EVICT_LRU) {
+        lru->head = LRU_NONE;
+        lru->tail = LRU_NONE;
+    } else {
+        memset(lru->clock_bits, 0, array_size);
+        lru->hand = 0;
+    }
+}
+
+/**
+ * Copies the eviction state of a map with `array_size` slots.
+ */
+static struct chmap_lru * lru_clone(const struct chmap_lru * lru, const size_t array_size) {
+    struct chmap_lru * clone = malloc(sizeof(struct chmap_lru));
+
+    *clone = *lru;
+    clone->keywords = malloc(array_size * sizeof(uint64_t));
+    memcpy(clone->keywords, lru->keywords, array_size * sizeof(uint64_t));
+
+    if (lru->policy == CHMAP_EVICT_LRU) {
+        clone->prev = malloc(array_size * sizeof(size_t));
+        clone->next = malloc(array_size * sizeof(size_t));
+        memcpy(clone->prev, lru->prev, array_size * sizeof(size_t));
+        memcpy(clone->next, lru->next, array_size * sizeof(size_t));
+    } else {
+        clone->clock_bits = malloc(array_size);
+        memcpy(clone->clock_bits, lru->clock_bits, array_size);
+    }
+
+    return clone;
+}
+
+static void lru_free(struct chmap_lru * lru) {
+    if (lru == NULL) {
+        return;
+    }
+
+    free(lru->prev);
+    free(lru->next);
+    free(lru->clock_bits);
+    free(lru->keywords);
+    free(lru);
+}
+
+struct chmap * chmap_cache_new(
+    const size_t item_size,
+    const size_t key_size,
+    const size_t capacity,
+    const enum chmap_evict_policy policy
+) {
+    struct chmap * map = chmap_new(item_size, key_size);
+    const size_t array_size = (size_t)(capacity / CACHE_LOAD_FACTOR) + 1;
+
+    assert(capacity > 0);
+
+    if (array_size > map->array_size) {
+        resize_map(map, array_size);
+    }
+
+    map->lru = malloc(sizeof(struct chmap_lru));
+    map->lru->policy = policy;
+    map->lru->capacity = capacity;
+    map->lru->head = LRU_NONE;
+    map->lru->tail = LRU_NONE;
+    map->lru->prev = NULL;
+    map->lru->next = NULL;
+    map->lru->clock_bits = NULL;
+    map->lru->hand = 0;
+    map->lru->keywords = NULL;
+    memset(&map->lru->counters, 0, sizeof(struct chmap_lru_counters));
+    lru_resize(map->lru, 0, map->array_size);
+
+    return map;
+}
+
+struct chmap * chmap_cache_new_bytes(
+    const size_t item_size,
+    const size_t key_size,
+    const size_t max_bytes,
+    const enum chmap_evict_policy policy
+) {
+    const size_t slot_bytes = sizeof(struct entry) + item_size + sizeof(size_t) + lru_slot_bytes(policy);
+    const size_t slots = max_bytes / slot_bytes;
+
+    if (slots < 3) {
+        return NULL;
+    }
+
+    return chmap_cache_new(item_size, key_size, (size_t)((slots - 1) * CACHE_LOAD_FACTOR), policy);
+}
+
+struct chmap * chmap_lru_new(const size_t item_size, const size_t key_size, const size_t capacity) {
+    return chmap_cache_new(item_size, key_size, capacity, CHMAP_EVICT_LRU);
+}
+
+struct chmap * chmap_lru_new_bytes(const size_t item_size, const size_t key_size, const size_t max_bytes) {
+    return chmap_cache_new_bytes(item_size, key_size, max_bytes, CHMAP_EVICT_LRU);
+}
+
+const struct chmap_lru_counters * chmap_get_lru_counters(struct chmap * map) {
+    return map->lru != NULL ? &map->lru->counters : NULL;
+}
+
+/* --- expiry --- */
+
+/**
+ * Which level of the timer wheel an expiry goes in, with the wheel at tick `now`: the lowest level whose
+ * turn it falls in. Level 0 takes the rest of the current turn of its slots, each level above takes the
+ * rest of its own turn, and the top level takes everything further out than that.
+ */
+static size_t ttl_level(const uint64_t expires, const uint64_t now) {
+    for (size_t level = CHMAP_TTL_WHEEL_LEVELS - 1; level > 0; level--) {
+        if (expires >> (CHMAP_TTL_WHEEL_BITS * level) != now >> (CHMAP_TTL_WHEEL_BITS * level)) {
+            return level;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Links backing array index `index` into the wheel slot for its expiry.
+ */
+static void ttl_link(struct chmap_ttl * ttl, const size_t index) {
+    // Anything already due goes in the current tick's slot. Cascades happen before that slot is drained,
+    // and `chmap_expire` drains it again first thing, for expiries set after the wheel passed them.
+    const uint64_t expires = ttl->expires[index] > ttl->wheel_now ? ttl->expires[index] : ttl->wheel_now;
+    const size_t level = ttl_level(expires, ttl->wheel_now);
+    const size_t slot = (expires >> (CHMAP_TTL_WHEEL_BITS * level)) & (CHMAP_TTL_WHEEL_SLOTS - 1);
+    size_t * head = &ttl->wheel[level][slot];
+
+    ttl->wheel_slots[index] = (unsigned char)(level * CHMAP_TTL_WHEEL_SLOTS + slot);
+    ttl->prev[index] = TTL_NONE;
+    ttl->next[index] = *head;
+
+    if (*head != TTL_NONE) {
+        ttl->prev[*head] = index;
+    }
+
+    *head = index;
+}
+
+/**
+ * Takes backing array index `index` out of its wheel slot.
+ */
+static void ttl_unlink(struct chmap_ttl * ttl, const size_t index) {
+    const size_t prev = ttl->prev[index];
+    const size_t next = ttl->next[index];
+
+    if (prev != TTL_NONE) {
+        ttl->next[prev] = next;
+    } else {
+        const size_t slot = ttl->wheel_slots[index];
+
+        ttl->wheel[slot / CHMAP_TTL_WHEEL_SLOTS][slot % CHMAP_TTL_WHEEL_SLOTS] = next;
+    }
+
+    if (next != TTL_NONE) {
+        ttl->prev[next] = prev;
+    }
+}
+
+/**
+ * Starts tracking a new entry, with hash `hash` and its item at `index`. It doesn't expire until it's
+ * given an expiry.
+ */
+static void ttl_insert(struct chmap_ttl * ttl, const size_t index, const uint64_t hash) {
+    ttl->keywords[index] = hash;
+    ttl->expires[index] = 0;
+}
+
+/**
+ * Stops tracking the entry with its item at `index`.
+ */
+static void ttl_remove(struct chmap_ttl * ttl, const size_t index) {
+    if (ttl->expires[index] != 0) {
+        ttl_unlink(ttl, index);
+        ttl->expires[index] = 0;
+        ttl->count--;
+    }
+}
+
+/**
+ * Sets when the entry with its item at `index` expires, or makes it never expire with 0.
+ */
+static void ttl_set(struct chmap_ttl * ttl, const size_t index, const uint64_t expires) {
+    ttl_remove(ttl, index);
+
+    if (expires != 0) {
+        ttl->expires[index] = expires;
+        ttl->count++;
+        ttl_link(ttl, index);
+    }
+}
+
+/**
+ * Whether the entry at `index` of the translation array has expired by the map's current time.
+ */
+static int ttl_due(struct chmap * map, const size_t index) {
+    const uint64_t expires = map->ttl->expires[map->translation_array[index].backing_array_key];
+
+    return expires != 0 && expires <= map->ttl->now;
+}
+
+/**
+ * Removes the entry at `index` of the translation array because it expired.
+ */
+static void ttl_expire_entry(struct chmap * map, const size_t index) {
+    const uint64_t hash = map->translation_array[index].keyword;
+
+    if (map->ttl->on_expire != NULL) {
+        map->ttl->on_expire(entry_item(map, &map->translation_array[index]), map->ttl->on_expire_ctx);
+    }
+
+    remove_entry(map, index);
+    journal_record(map, JOURNAL_OP_DEL, hash, NULL);
+}
+
+/**
+ * Removes the entry at `index` of the translation array if it has expired by the map's current time,
+ * so that lookups and puts never see an expired item. Returns `map->array_size` if it was removed, as
+ * though it had never been found, or `index` if it's still there.
+ */
+static size_t ttl_expire_if_due(struct chmap * map, const size_t index) {
+    if (map->ttl == NULL || index == map->array_size || !ttl_due(map, index)) {
+        return index;
+    }
+
+    ttl_expire_entry(map, index);
+
+    return map->array_size;
+}
+
+/**
+ * Moves every entry in wheel slot `slot` of `level` down to the level its expiry now belongs in.
+ */
+static void ttl_cascade(struct chmap_ttl * ttl, const size_t level, const size_t slot) {
+    size_t index = ttl->wheel[level][slot];
+
+    // Detach the whole list first, since entries that are still far out land back in the same slot.
+    ttl->wheel[level][slot] = TTL_NONE;
+
+    while (index != TTL_NONE) {
+        const size_t next = ttl->next[index];
+
+        ttl_link(ttl, index);
+        index = next;
+    }
+}
+
+/**
+ * Removes every entry in slot `slot` of level 0 of the wheel, returning how many there were.
+ */
+static size_t ttl_drain(struct chmap * map, const size_t slot) {
+    size_t * head = &map->ttl->wheel[0][slot];
+    size_t expired = 0;
+
+    // Removing an entry unlinks it, so this takes the head until the slot is empty.
+    while (*head != TTL_NONE) {
+        ttl_expire_entry(map, find_hash(map, map->ttl->keywords[*head]));
+        expired++;
+    }
+
+    return expired;
+}
+
+/**
+ * Makes room for expiry state for backing array indices up to `new_size`.
+ */
+static void ttl_resize(struct chmap_ttl * ttl, const size_t old_size, const size_t new_size) {
+    ttl->expires = realloc(ttl->expires, new_size * sizeof(uint64_t));
+    ttl->keywords = realloc(ttl->keywords, new_size * sizeof(uint64_t));
+    ttl->prev = realloc(ttl->prev, new_size * sizeof(size_t));
+    ttl->next = realloc(ttl->next, new_size * sizeof(size_t));
+    ttl->wheel_slots = realloc(ttl->wheel_slots, new_size * sizeof(unsigned char));
+
+    // Nothing is stored at the new indices yet, so nothing there expires.
+    memset(ttl->expires + old_size, 0, (new_size - old_size) * sizeof(uint64_t));
+}
+
+/**
+ * Forgets every expiry, for a map that was just cleared.
+ */
+static void ttl_clear(struct chmap_ttl * ttl, const size_t array_size) {
+    memset(ttl->expires, 0, array_size * sizeof(uint64_t));
+    memset(ttl->wheel, 0xff, sizeof(ttl->wheel));
+    ttl->count = 0;
+}
+
+/**
+ * Copies the expiry state of a map with `array_size` slots.
+ */
+static struct chmap_ttl * ttl_clone(const struct chmap_ttl * ttl, const size_t array_size) {
+    struct chmap_ttl * clone = malloc(sizeof(struct chmap_ttl));
+
+    *clone = *ttl;
+    clone->expires = malloc(array_size * sizeof(uint64_t));
+    clone->keywords = malloc(array_size * sizeof(uint64_t));
+    clone->prev = malloc(array_size * sizeof(size_t));
+    clone->next = malloc(array_size * sizeof(size_t));
+    clone->wheel_slots = malloc(array_size * sizeof(unsigned char));
+
+    memcpy(clone->expires, ttl->expires, array_size * sizeof(uint64_t));
+    memcpy(clone->keywords, ttl->keywords, array_size * sizeof(uint64_t));
+    memcpy(clone->prev, ttl->prev, array_size * sizeof(size_t));
+    memcpy(clone->next, ttl->next, array_size * sizeof(size_t));
+    memcpy(clone->wheel_slots, ttl->wheel_slots, array_size * sizeof(unsigned char));
+
+    return clone;
+}
+
+static void ttl_free(struct chmap_ttl * ttl) {
+    if (ttl == NULL) {
+        return;
+    }
+
+    free(ttl->expires);
+    free(ttl->keywords);
+    free(ttl->prev);
+    free(ttl->next);
+    free(ttl->wheel_slots);
+    free(ttl);
+}
+
+int chmap_ttl_enable(
+    struct chmap * map,
+    const uint64_t now,
+    void (*on_expire)(const void * item, void * ctx),
+    void * ctx
+) {
+    // Journals don't record expiries, so a map recovered from one would never expire anything.
+    if (map->ttl != NULL || map->journal_path != NULL || map->flags & (CHMAP_INLINE_ITEMS | CHMAP_MULTIMAP)) {
+        return -1;
+    }
+
+    map->ttl = malloc(sizeof(struct chmap_ttl));
+    map->ttl->now = now;
+    map->ttl->wheel_now = now;
+    map->ttl->count = 0;
+    map->ttl->on_expire = on_expire;
+    map->ttl->on_expire_ctx = ctx;
+    map->ttl->expires = NULL;
+    map->ttl->keywords = NULL;
+    map->ttl->prev = NULL;
+    map->ttl->next = NULL;
+    map->ttl->wheel_slots = NULL;
+    memset(map->ttl->wheel, 0xff, sizeof(map->ttl->wheel));
+    ttl_resize(map->ttl, 0, map->array_size);
+
+    // Entries already in the map need their hashes, so that they can be given expiries later.
+    for (size_t i = 0; i < map->array_size; i++) {
+        if (map->translation_array[i].has_entry) {
+            map->ttl->keywords[map->translation_array[i].backing_array_key] = map->translation_array[i].keyword;
+        }
+    }
+
+    return 0;
+}
+
+int chmap_ttl_set_now(struct chmap * map, const uint64_t now) {
+    if (map->ttl == NULL) {
+        return -1;
+    }
+
+    map->ttl->now = now;
+
+    return 0;
+}
+
+int chmap_put_ttl(struct chmap * map, const void * key, const void * item, const uint64_t expires_at) {
+    if (map->ttl == NULL) {
+        return -1;
+    }
+
+    const uint64_t hash = chmap_hash(map, key);
+    int inserted;
+
+    if (map->used_size >= map->array_size * MAX_LOAD_FACTOR) {
+        grow_map(map);
+    }
+
+    const size_t index = upsert_index(map, hash, &inserted);
+
+    memcpy(entry_item(map, &map->translation_array[index]), item, map->isize);
+    journal_record(map, JOURNAL_OP_PUT, hash, item);
+    ttl_set(map->ttl, map->translation_array[index].backing_array_key, expires_at);
+
+    return !inserted;
+}
+
+int chmap_set_expiry(struct chmap * map, const void * key, const uint64_t expires_at) {
+    if (map->ttl == NULL) {
+        return -1;
+    }
+
+    // An expired entry is gone, even if nothing has collected it yet, so it can't be brought back.
+    const size_t index = ttl_expire_if_due(map, find_hash(map, chmap_hash(map, key)));
+
+    if (index == map->array_size) {
+        return 0;
+    }
+
+    ttl_set(map->ttl, map->translation_array[index].backing_array_key, expires_at);
+
+    return 1;
+}
+
+size_t chmap_expire(struct chmap * map, const uint64_t now) {
+    struct chmap_ttl * ttl = map->ttl;
+    size_t expired = 0;
+
+    if (ttl == NULL) {
+        return 0;
+    }
+
+    ttl->now = now;
+
+    // Expiries set after the wheel had already passed them wait in the current tick's slot.
+    expired += ttl_drain(map, ttl->wheel_now & (CHMAP_TTL_WHEEL_SLOTS - 1));
+
+    while (ttl->wheel_now < now) {
+        if (ttl->count == 0) {
+            // Nothing left to expire, so there is no point stepping through the empty slots.
+            ttl->wheel_now = now;
+            break;
+        }
+
+        const uint64_t tick = ++ttl->wheel_now;
+
+        // Each level above 0 empties one slot into the levels below whenever the ones below wrap around.
+        for (size_t level = CHMAP_TTL_WHEEL_LEVELS - 1; level > 0; level--) {
+            const size_t shift = CHMAP_TTL_WHEEL_BITS * level;
+
+            if ((tick & ((UINT64_C(1) << shift) - 1)) == 0) {
+                ttl_cascade(ttl, level, (tick >> shift) & (CHMAP_TTL_WHEEL_SLOTS - 1));
+            }
+        }
+
+        expired += ttl_drain(map, tick & (CHMAP_TTL_WHEEL_SLOTS - 1));
+    }
+
+    return expired;
+}
+
+/* --- front filters --- */
+
+/**
+ * Multipliers that pick a hash's bit in each word of its block, one per word. These are the salts of
+ * the split block Bloom filters in Parquet; any distinct odd constants would do.
+ */
+static const uint32_t FILTER_SALTS[FILTER_BLOCK_WORDS] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du, 0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+};
+
+/**
+ * The block of `filter` that `hash` sets its bits in. The high half of the hash picks the block, and the
+ * low half picks the bits within it.
+ */
+static uint64_t * filter_block(const struct chmap_filter * filter, const uint64_t hash) {
+    return &filter->blocks[((hash >> 32) * filter->block_count >> 32) * FILTER_BLOCK_WORDS];
+}
+
+/**
+ * The bit `hash` sets in word `word` of its block.
+ */
+static uint64_t filter_bit(const uint64_t hash, const size_t word) {
+    return UINT64_C(1) << ((uint32_t)((uint32_t)hash * FILTER_SALTS[word]) >> (32 - 6));
+}
+
+/**
+ * Allocates `block_count` blocks for `filter`, each starting on a cache line, without clearing them.
+ */
+static void filter_alloc(struct chmap_filter * filter, const size_t block_count) {
+    // Over-allocate by a cache line, so that the first block can be moved up to start on one.
+    filter->raw = malloc(block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t) + FILTER_ALIGN);
+    filter->blocks = (uint64_t *)(((uintptr_t)filter->raw + FILTER_ALIGN - 1) & ~(uintptr_t)(FILTER_ALIGN - 1));
+    filter->block_count = block_count;
+}
+
+static void filter_add(struct chmap_filter * filter, const uint64_t hash) {
+    uint64_t * block = filter_block(filter, hash);
+
+    for (size_t word = 0; word < FILTER_BLOCK_WORDS; word++) {
+        block[word] |= filter_bit(hash, word);
+    }
+}
+
+static int filter_check(const struct chmap_filter * filter, const uint64_t hash) {
+    const uint64_t * block = filter_block(filter, hash);
+    uint64_t missing = 0;
+
+    // No early exit: the whole block is one cache line, and a branch per word costs more than it saves.
+    for (size_t word = 0; word < FILTER_BLOCK_WORDS; word++) {
+        missing |= filter_bit(hash, word) & ~block[word];
+    }
+
+    return missing == 0;
+}
+
+/**
+ * Builds the filter of `map` again from scratch, sized for as many keys as the map holds before it next
+ * grows. Only allocates if that changed since the last build.
+ */
+static void filter_build(struct chmap * map) {
+    struct chmap_filter * filter = map->filter;
+    const size_t capacity = (size_t)(map->array_size * MAX_LOAD_FACTOR) + 1;
+    const size_t block_bits = FILTER_BLOCK_WORDS * 64;
+    const size_t block_count = (capacity * filter->bits_per_key + block_bits - 1) / block_bits;
+
+    if (block_count != filter->block_count) {
+        free(filter->raw);
+        filter_alloc(filter, block_count);
+    }
+
+    memset(filter->blocks, 0, block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t));
+    filter->capacity = capacity;
+    filter->deletes = 0;
+    filter->counters.rebuilds++;
+
+    for (size_t i = 0; i < map->array_size; i++) {
+        if (map->translation_array[i].has_entry) {
+            filter_add(filter, map->translation_array[i].keyword);
+        }
+    }
+}
+
+/**
+ * Notes that `count` keys were removed from `map`, rebuilding its filter if too many of their bits are
+ * left behind. Only call this between operations, while the translation array holds every entry.
+ */
+static void filter_deleted(struct chmap * map, const size_t count) {
+    map->filter->deletes += count;
+
+    if (map->filter->deletes * FILTER_STALE_DIVISOR >= map->filter->capacity) {
+        filter_build(map);
+    }
+}
+
+/**
+ * Forgets every key, for a map that was just cleared.
+ */
+static void filter_clear(struct chmap_filter * filter) {
+    memset(filter->blocks, 0, filter->block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t));
+    filter->deletes = 0;
+}
+
+static struct chmap_filter * filter_clone(const struct chmap_filter * filter) {
+    struct chmap_filter * clone = malloc(sizeof(struct chmap_filter));
+    const size_t bytes = filter->block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+
+    *clone = *filter;
+    filter_alloc(clone, filter->block_count);
+    memcpy(clone->blocks, filter->blocks, bytes);
+
+    return clone;
+}
+
+static void filter_free(struct chmap_filter * filter) {
+    if (filter == NULL) {
+        return;
+    }
+
+    free(filter->raw);
+    free(filter);
+}
+
+int chmap_filter_enable(struct chmap * map, const size_t bits_per_key) {
+    if (map->filter != NULL) {
+        return -1;
+    }
+
+    map->filter = calloc(1, sizeof(struct chmap_filter));
+    map->filter->bits_per_key = bits_per_key != 0 ? bits_per_key : CHMAP_FILTER_BITS_PER_KEY;
+    filter_build(map);
+
+    // The first build isn't a rebuild.
+    map->filter->counters.rebuilds = 0;
+
+    return 0;
+}
+
+#ifdef CHMAP_STATS
+/**
+ * Counts a lookup of `hash` that ended at `index` against the front filter of `map`, if it has one.
+ * Misses check the filter again to tell whether it rejected the key or let it through; the block was
+ * just read, so that's cheap.
+ */
+static void filter_count_lookup(struct chmap * map, const uint64_t hash, const size_t index) {
+    if (map->filter == NULL) {
+        return;
+    }
+
+    map->filter->counters.lookups++;
+
+    if (index == map->array_size) {
+        if (filter_check(map->filter, hash)) {
+            map->filter->counters.false_positives++;
+        } else {
+            map->filter->counters.negatives++;
+        }
+    }
+}
+#endif
+
+void chmap_filter_disable(struct chmap * map) {
+    filter_free(map->filter);
+    map->filter = NULL;
+}
+
+const struct chmap_filter_counters * chmap_get_filter_counters(struct chmap * map) {
+    return map->filter != NULL ? &map->filter->counters : NULL;
+}
+
 void debug_map(struct chmap * map) {
     for (size_t i = 0; i < map->array_size; i++) {
         struct entry entry = map->translation_array[i];
@@ -369,7 +3128,9 @@ void debug_map(struct chmap * map) {
             entry.backing_array_key, 
             entry.psl,
             i,
-            *((size_t*)map->backing_array + entry.backing_array_key * map->isize)
+            map->flags & CHMAP_INLINE_ITEMS
+                ? entry.backing_array_key
+                : *((size_t*)map->backing_array + entry.backing_array_key * map->isize)
         );
     }
 }
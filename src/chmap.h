@@ -1,15 +1,252 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 
 struct entry {
     int has_entry;
     size_t psl;
     uint64_t keyword;
+    // Where the entry's item is in the backing array or, in maps with CHMAP_INLINE_ITEMS, the item itself.
     size_t backing_array_key;
 };
 
+// Flag for `chmap_new_flags`: store items of up to CHMAP_INLINE_MAX_SIZE bytes in the translation array.
+#define CHMAP_INLINE_ITEMS 1u
+
+// The largest item that fits in a slot of the translation array: 8 bytes on 64-bit platforms.
+#define CHMAP_INLINE_MAX_SIZE sizeof(size_t)
+
+// Flag for `chmap_new_flags`: keep every item put under a key, instead of overwriting.
+#define CHMAP_MULTIMAP 2u
+
+// Joins split their build side into partitions small enough to fit in a cache of this many bytes.
+#ifndef CHMAP_JOIN_CACHE_SIZE
+#define CHMAP_JOIN_CACHE_SIZE (256 * 1024)
+#endif
+
+// The number of buckets in `chmap_stats.psl_histogram`.
+#define CHMAP_PSL_HISTOGRAM_LENGTH 16
+
+// Each power of two in a `chmap_histogram` is split into 2^CHMAP_HISTOGRAM_SUB_BITS buckets, so recorded
+// values are kept to within 1/16th of what they were.
+#define CHMAP_HISTOGRAM_SUB_BITS 4
+#define CHMAP_HISTOGRAM_BUCKETS ((65 - CHMAP_HISTOGRAM_SUB_BITS) << CHMAP_HISTOGRAM_SUB_BITS)
+
+// Expiry times are kept in a timer wheel of CHMAP_TTL_WHEEL_LEVELS levels, each with 2^CHMAP_TTL_WHEEL_BITS
+// slots. A slot of level `l` covers 2^(CHMAP_TTL_WHEEL_BITS * l) ticks, so four levels of 64 reach 2^24
+// ticks ahead; anything further out waits in the top level and is sorted down as the wheel turns.
+#define CHMAP_TTL_WHEEL_BITS 6
+#define CHMAP_TTL_WHEEL_SLOTS (1 << CHMAP_TTL_WHEEL_BITS)
+#define CHMAP_TTL_WHEEL_LEVELS 4
+
+// Bits a front filter spends per key it's sized for, unless `chmap_filter_enable` is given another
+// number. Ten bits keep false positives near 1%.
+#ifndef CHMAP_FILTER_BITS_PER_KEY
+#define CHMAP_FILTER_BITS_PER_KEY 10
+#endif
+
+/**
+ * A log-linear histogram of latencies in nanoseconds, in the style of HdrHistogram: the smallest values
+ * get a bucket each, and every power of two above them is split into the same number of buckets.
+ */
+struct chmap_histogram {
+    // The number of values recorded, and the largest of them.
+    uint64_t count;
+    uint64_t max;
+
+    uint64_t buckets[CHMAP_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Per-operation latencies, recorded by a map once `chmap_trace_enable` has been called on it.
+ */
+struct chmap_trace {
+    struct chmap_histogram put;
+    struct chmap_histogram get;
+    struct chmap_histogram del;
+
+    // Puts that had to grow the map before inserting. These are recorded in `put` as well.
+    struct chmap_histogram growing_put;
+};
+
+/**
+ * How a map made with `chmap_cache_new` picks the item to evict when it's full.
+ * - `CHMAP_EVICT_LRU`: the least recently used item. Every get moves the item to the front of a list.
+ * - `CHMAP_EVICT_CLOCK`: an item that wasn't used since a hand sweeping the backing array last passed
+ *   it. A get at most sets a bit, so reads stay nearly read-only, at the cost of approximating LRU.
+ */
+enum chmap_evict_policy {
+    CHMAP_EVICT_LRU,
+    CHMAP_EVICT_CLOCK,
+};
+
+/**
+ * Cache counters kept by bounded maps, made with `chmap_cache_new` or `chmap_lru_new`.
+ */
+struct chmap_lru_counters {
+    // Gets that found their key, and gets that didn't. CLOCK maps leave these at zero, to keep gets
+    // from writing to the map.
+    size_t hits;
+    size_t misses;
+
+    // Entries removed to make room for new ones.
+    size_t evictions;
+};
+
+/**
+ * The eviction state of a bounded map. It is kept per backing array index, since those stay put while
+ * entries move around the translation array. Under LRU, `prev` and `next` link each entry's index to the
+ * ones used just before and just after it; under CLOCK, each index has a byte of bits instead.
+ */
+struct chmap_lru {
+    enum chmap_evict_policy policy;
+
+    // The most entries the map holds before it starts evicting.
+    size_t capacity;
+
+    // The most and least recently used backing array indices, or SIZE_MAX if the map is empty.
+    size_t head;
+    size_t tail;
+
+    // Neighbours of each backing array index in the list, or SIZE_MAX past either end.
+    size_t * prev;
+    size_t * next;
+
+    // CLOCK only: whether each backing array index holds an item and whether it was used since the hand
+    // last passed it, and the index the hand will look at next.
+    unsigned char * clock_bits;
+    size_t hand;
+
+    // The hash stored at each backing array index, so that the tail's entry can be found to evict it.
+    uint64_t * keywords;
+
+    struct chmap_lru_counters counters;
+};
+
+/**
+ * The expiry state of a map with `chmap_ttl_enable`. Like eviction state, it's kept per backing array
+ * index. Every index with an expiry is linked into one slot of a hierarchical timer wheel, so expiring
+ * entries only looks at the slots that come due, never at the whole map.
+ */
+struct chmap_ttl {
+    // The time gets compare expiries against, and the last tick the wheel was advanced to.
+    uint64_t now;
+    uint64_t wheel_now;
+
+    // The number of entries with an expiry.
+    size_t count;
+
+    // When each backing array index expires, or 0 if it never does.
+    uint64_t * expires;
+
+    // The hash stored at each backing array index, so that an expired entry can be found to remove it.
+    uint64_t * keywords;
+
+    // Neighbours of each backing array index in its wheel slot, or SIZE_MAX past either end.
+    size_t * prev;
+    size_t * next;
+
+    // The wheel slot each backing array index is in, as `level * CHMAP_TTL_WHEEL_SLOTS + slot`.
+    unsigned char * wheel_slots;
+
+    // The first backing array index in each slot of each level, or SIZE_MAX if the slot is empty.
+    size_t wheel[CHMAP_TTL_WHEEL_LEVELS][CHMAP_TTL_WHEEL_SLOTS];
+
+    // Called with each item just before it's removed for expiring, or NULL.
+    void (*on_expire)(const void * item, void * ctx);
+    void * on_expire_ctx;
+};
+
+/**
+ * Counters kept by a map's front filter, for judging whether it pays for itself. Like `chmap_counters`,
+ * the lookup counters are only kept when chmap is compiled with CHMAP_STATS, so that gets don't write to
+ * the map. Only lookups made through `chmap_get` and `chmap_set_contains` are counted.
+ */
+struct chmap_filter_counters {
+    // Lookups that checked the filter, and the ones it answered alone, without probing the map.
+    size_t lookups;
+    size_t negatives;
+
+    // Lookups the filter let through that found nothing anyway.
+    size_t false_positives;
+
+    // The number of times the filter was built from scratch, on resizes and after many deletes.
+    size_t rebuilds;
+};
+
+/**
+ * A blocked Bloom filter over the hashes in a map, checked before probing so that most lookups of
+ * missing keys never touch the translation array. Each hash picks one 64-byte block and sets one bit in
+ * each of its eight words, so a check reads a single cache line.
+ */
+struct chmap_filter {
+    // `block_count` blocks of eight words each, aligned to a cache line. `raw` is what was allocated.
+    uint64_t * blocks;
+    void * raw;
+    size_t block_count;
+
+    size_t bits_per_key;
+
+    // How many keys the filter was sized for, and how many were removed since it was built. Removed
+    // keys keep their bits set, so the filter is rebuilt once there are too many of them.
+    size_t capacity;
+    size_t deletes;
+
+    struct chmap_filter_counters counters;
+};
+
+/**
+ * Whether a `chmap_grow_event` is for a resize that is about to start, or one that just finished.
+ */
+enum chmap_grow_phase {
+    CHMAP_GROW_START,
+    CHMAP_GROW_END,
+};
+
+/**
+ * Passed to a map's grow hook around every resize.
+ */
+struct chmap_grow_event {
+    enum chmap_grow_phase phase;
+
+    // The number of slots before and after the resize, and the number of items being moved.
+    size_t old_capacity;
+    size_t new_capacity;
+    size_t used_size;
+
+    // How long the resize took, in nanoseconds. Always 0 for CHMAP_GROW_START.
+    uint64_t elapsed_ns;
+};
+
+/**
+ * Cumulative operation counters for a map. These are only counted when chmap is compiled with
+ * CHMAP_STATS defined; otherwise they stay zero, and counting them costs nothing.
+ */
+struct chmap_counters {
+    // Number of lookups (`chmap_get` and friends), and how many of them found their key.
+    size_t gets;
+    size_t hits;
+    size_t misses;
+
+    // Number of slots stepped past while probing for a key, by lookups and inserts alike.
+    size_t probe_steps;
+
+    // Number of entries moved by robinhood swapping on insert and backward shifting on delete.
+    size_t shifts;
+};
+
+/**
+ * What `chmap_merge` does with keys that are in both maps.
+ */
+enum chmap_merge_policy {
+    CHMAP_MERGE_OVERWRITE,
+    CHMAP_MERGE_KEEP,
+    CHMAP_MERGE_COMBINE,
+};
+
 /**
  * The main struct for a map. Contains the backing array, data sizes, and the array length.
  */
@@ -41,20 +278,168 @@ struct chmap {
 
     // Top index of the backing array index stack.
     size_t bais_idx;
+
+    // CHMAP_* flags the map was created with.
+    unsigned int flags;
+
+    // Journal that puts and deletes are appended to, or NULL if this map isn't persistent.
+    FILE * journal;
+
+    // Path of the journal, kept so that it can be compacted into a fresh file.
+    char * journal_path;
+
+    // Number of records in the journal. Used to decide when it's worth compacting.
+    size_t journal_records;
+
+    // The number of times this map has been resized.
+    size_t grow_count;
+
+    // Operation counters, only kept up to date with CHMAP_STATS.
+    struct chmap_counters counters;
+
+    // Called at the start and end of every resize, or NULL.
+    void (*grow_hook)(const struct chmap_grow_event * event, void * ctx);
+    void * grow_hook_ctx;
+
+    // Latency histograms, or NULL if tracing isn't enabled.
+    struct chmap_trace * trace;
+
+    // Eviction state, or NULL if this isn't a bounded map.
+    struct chmap_lru * lru;
+
+    // Expiry state, or NULL if entries in this map never expire.
+    struct chmap_ttl * ttl;
+
+    // Front filter checked before probing, or NULL if lookups always probe.
+    struct chmap_filter * filter;
+};
+
+/**
+ * A snapshot of a map's shape and memory use, filled in by `chmap_stats`.
+ */
+struct chmap_stats {
+    // The number of items in the map, the number of slots, and the ratio of the two.
+    size_t used_size;
+    size_t array_size;
+    double load_factor;
+
+    // The longest and the average distance of an entry from its home slot.
+    size_t max_psl;
+    double mean_psl;
+
+    // `psl_histogram[i]` is the number of entries `i` slots from home. The last bucket also counts
+    // every entry that is further away than that.
+    size_t psl_histogram[CHMAP_PSL_HISTOGRAM_LENGTH];
+
+    // The number of times the map has been resized.
+    size_t grow_count;
+
+    // Bytes allocated for each of the map's arrays.
+    size_t translation_array_bytes;
+    size_t backing_array_bytes;
+    size_t bais_bytes;
+    size_t lru_bytes;
+    size_t ttl_bytes;
+    size_t filter_bytes;
+
+    // Cumulative counters, if compiled with CHMAP_STATS.
+    struct chmap_counters counters;
+};
+
+/**
+ * An immutable snapshot of a map, built by `chmap_freeze`. Instead of probing, it uses a minimal perfect
+ * hash over the stored hashes: each key's bucket has a pilot value that sends it straight to its own slot,
+ * so a lookup reads one pilot and one slot, with no collisions to resolve.
+ */
+struct chmap_frozen {
+    // The size of any given item.
+    size_t isize;
+
+    // The size of the key type.
+    size_t ksize;
+
+    // The number of entries, which is also the number of slots, since the hash is minimal.
+    size_t size;
+
+    // The number of positions keys were placed into. A few more than `size`, to make placement quick.
+    size_t table_size;
+
+    // The number of buckets keys are split into. Each has its own pilot.
+    size_t bucket_count;
+
+    // The number of buckets at the front that 60% of keys are sent to.
+    size_t dense_bucket_count;
+
+    // The seed that the bucket and position hashes are derived with.
+    uint64_t seed;
+
+    // The pilot for each bucket. At ~6 keys per bucket, this is under 3 bits per key.
+    uint16_t * pilots;
+
+    // Where positions past `size` were moved to, indexed by `position - size`.
+    size_t * remap;
+
+    // The distance between slots: the hash, then the item padded to 8 bytes.
+    size_t slot_size;
+
+    // The slots themselves. Each is the 8-byte hash of its key followed by its item.
+    unsigned char * slots;
+};
+
+/**
+ * The build side of a hash join, made by `chmap_join_build`: the row indices of one relation, in
+ * multimaps keyed by its key column. Rows are split between partitions by the top bits of their hashes.
+ */
+struct chmap_join {
+    // The number of partitions, always a power of two.
+    size_t partition_count;
+
+    // The partitions themselves, each mapping keys to `size_t` row indices.
+    struct chmap ** partitions;
+};
+
+/**
+ * How far `chmap_join_probe` got: the next probe row, and how many of its matches were already emitted.
+ * Start from all zeroes.
+ */
+struct chmap_join_cursor {
+    size_t row;
+    size_t match;
 };
 
 
 /**
  * Given an item_size, creates a new hashmap that can store items of item_size.
+ *
+ * Memory: a map only allocates when it is created, when it grows, and in the functions that say so
+ * (`chmap_clone`, `chmap_freeze`, journal and tracing setup). Gets, deletes, and puts that don't need
+ * to grow the map never touch the heap; use `chmap_reserve` to do all the growing up front.
  * 
  * @param item_size size of data that will be stored in this hashmap
  * @param key_size  size of keys that will be used in this hashmap
  */
 struct chmap * chmap_new(const size_t item_size, const size_t key_size);
 
+/**
+ * Like `chmap_new`, but with CHMAP_* flags that change how the map is laid out.
+ *
+ * With CHMAP_INLINE_ITEMS, items of up to CHMAP_INLINE_MAX_SIZE bytes are stored right in the
+ * translation array, and the map has no backing array or backing array index stack at all. That saves
+ * a dependent cache miss on every hit and 16 bytes per slot, but since robinhood shifting moves items
+ * along with their entries, pointers from `chmap_get` and friends only stay valid until the map is next
+ * modified. The flag is ignored for bigger items.
+ *
+ * With CHMAP_MULTIMAP, `chmap_put` and `chmap_upsert` always add a new item, even if the key already has
+ * some. Items with the same key sit next to each other in the same robinhood cluster, so `chmap_get_all`
+ * finds them all in one probe. `chmap_get` gets one of them, `chmap_take` removes one, and `chmap_del`
+ * removes them all. Merging into a multimap adds every item of the source. Multimaps can't be frozen or
+ * journaled.
+ */
+struct chmap * chmap_new_flags(const size_t item_size, const size_t key_size, const unsigned int flags);
+
 /**
  * Puts an item into the given map at the given key. Returns 1 if an item was overwritten,
- * or a 0 if the slot was empty.
+ * or a 0 if the slot was empty. Only allocates if the map has to grow to fit the item.
  */
 int chmap_put(
     struct chmap * map, 
@@ -63,18 +448,644 @@ int chmap_put(
 );
 
 /**
- * Gets a pointer to the item associated with `key`, or `NULL` if not found.
+ * Gets a pointer to the item associated with `key`, or `NULL` if not found. Never allocates.
  */
 void * chmap_get(struct chmap * map, const void * key);
 
 /**
- * Deletes the item at `key`.
+ * Gets a pointer to the item associated with `key`, inserting a zeroed item first if there isn't one.
+ * This hashes and probes once, where `chmap_get` followed by `chmap_put` would do both twice, so it's the
+ * way to update items in place (counters, appending to a value...).
+ *
+ * If `inserted` isn't `NULL`, it is set to 1 if the item was just inserted, or 0 if it already existed.
+ * The pointer is valid until the map is next modified. Writes through it aren't journaled.
+ */
+void * chmap_upsert(struct chmap * map, const void * key, int * inserted);
+
+/**
+ * Deletes the item at `key`. Never allocates, and never shrinks the map.
  */
 void chmap_del(struct chmap * map, const void * key);
 
+/**
+ * Hashes `key` the way every map with this map's key size does. The result can be passed to the `_hashed`
+ * functions of any such map, so a key used with several maps, or several times, is only hashed once.
+ */
+uint64_t chmap_hash(struct chmap * map, const void * key);
+
+/**
+ * Hashes a key of `ksize` bytes the way `chmap_hash` does for any map with that key size, for code that
+ * hashes keys before there's a map to hash them with.
+ */
+uint64_t chmap_hash_key(const void * key, const size_t ksize);
+
+/**
+ * Like `chmap_put`, but with a hash from `chmap_hash` instead of the key.
+ */
+int chmap_put_hashed(
+    struct chmap * map,
+    const uint64_t hash,
+    const void * item
+);
+
+/**
+ * Like `chmap_upsert`, but with a hash from `chmap_hash` instead of the key.
+ */
+void * chmap_upsert_hashed(struct chmap * map, const uint64_t hash, int * inserted);
+
+/**
+ * Like `chmap_get`, but with a hash from `chmap_hash` instead of the key.
+ */
+void * chmap_get_hashed(struct chmap * map, const uint64_t hash);
+
+/**
+ * Like `chmap_del`, but with a hash from `chmap_hash` instead of the key.
+ */
+void chmap_del_hashed(struct chmap * map, const uint64_t hash);
+
+/**
+ * Deletes the item at `key`, copying it into `out_item` first (unless `out_item` is `NULL`).
+ * Returns 1 if there was an item at `key`, or 0 if there wasn't, in which case `out_item` is left alone.
+ */
+int chmap_take(struct chmap * map, const void * key, void * out_item);
+
+/**
+ * Like `chmap_take`, but with a hash from `chmap_hash` instead of the key.
+ */
+int chmap_take_hashed(struct chmap * map, const uint64_t hash, void * out_item);
+
+/**
+ * Fills in `out` with the map's size, load, PSL distribution and memory use, plus the cumulative
+ * counters if compiled with CHMAP_STATS. This scans the whole map, so it isn't meant for hot paths.
+ */
+void chmap_stats(struct chmap * map, struct chmap_stats * out);
+
+/**
+ * Sets a function to be called at the start and end of every resize of the map, including the ones
+ * `chmap_put` does on its own. Pass NULL to remove it.
+ */
+void chmap_set_grow_hook(
+    struct chmap * map,
+    void (*hook)(const struct chmap_grow_event * event, void * ctx),
+    void * ctx
+);
+
+/**
+ * Starts recording how long each put, get and delete on the map takes (not counting hashing the key)
+ * into the histograms returned by `chmap_get_trace`. Does nothing if tracing is already enabled.
+ * Returns 0 on success, or -1 if the histograms couldn't be allocated.
+ */
+int chmap_trace_enable(struct chmap * map);
+
+/**
+ * Stops recording latencies and frees the map's histograms.
+ */
+void chmap_trace_disable(struct chmap * map);
+
+/**
+ * Gets the latency histograms of a map, or NULL if tracing isn't enabled.
+ */
+const struct chmap_trace * chmap_get_trace(struct chmap * map);
+
+/**
+ * Gets the latency, in nanoseconds, that `percentile` percent (0 to 100) of recorded values are at or
+ * below. Returns 0 for an empty histogram.
+ */
+uint64_t chmap_histogram_percentile(const struct chmap_histogram * histogram, const double percentile);
+
+/**
+ * Creates a new, empty set of keys of `key_size` bytes. A set is a map with no items: it stores only the
+ * hashes of its keys, with no backing array, so it works with the rest of the API (`chmap_clear`,
+ * `chmap_stats`, journaling...) too.
+ */
+struct chmap * chmap_set_new(const size_t key_size);
+
+/**
+ * Adds `key` to the set. Returns 1 if it was added, or 0 if it was already there.
+ */
+int chmap_set_insert(struct chmap * set, const void * key);
+
+/**
+ * Returns 1 if `key` is in the set, or 0 if it isn't.
+ */
+int chmap_set_contains(struct chmap * set, const void * key);
+
+/**
+ * Removes `key` from the set. Returns 1 if it was there, or 0 if it wasn't.
+ */
+int chmap_set_remove(struct chmap * set, const void * key);
+
+/**
+ * Batched versions of the above, for `count` keys packed one after another in `keys`. Keys are hashed a
+ * batch at a time and their slots prefetched before any are probed, so the cache misses overlap instead
+ * of being paid one after another.
+ *
+ * They return how many keys were inserted, found or removed. If `found` isn't NULL, `found[i]` is set to
+ * whether the i-th key is in the set.
+ */
+size_t chmap_set_insert_many(struct chmap * set, const void * keys, const size_t count);
+size_t chmap_set_contains_many(struct chmap * set, const void * keys, const size_t count, unsigned char * found);
+size_t chmap_set_remove_many(struct chmap * set, const void * keys, const size_t count);
+
+/**
+ * Calls `each(item, ctx)` for every item stored under `key`, and returns how many there were. Only a
+ * multimap can have more than one. `each` must not modify the map.
+ */
+size_t chmap_get_all(
+    struct chmap * map,
+    const void * key,
+    void (*each)(void * item, void * ctx),
+    void * ctx
+);
+
+/**
+ * Like `chmap_get_all`, but with a hash from `chmap_hash` instead of the key.
+ */
+size_t chmap_get_all_hashed(
+    struct chmap * map,
+    const uint64_t hash,
+    void (*each)(void * item, void * ctx),
+    void * ctx
+);
+
+/**
+ * Returns how many items are stored under `key`: 0 or 1, or any number in a multimap.
+ */
+size_t chmap_count(struct chmap * map, const void * key);
+
+/**
+ * The number types `chmap_add_many` can add.
+ */
+enum chmap_number_type {
+    CHMAP_U64,
+    CHMAP_I64,
+    CHMAP_F64,
+};
+
+/**
+ * Adds `delta` to the number stored under `key`, starting from 0 if the key isn't in the map yet, and
+ * returns the new value. This is one probe, like `chmap_upsert`, and it's journaled. The map's items must
+ * be exactly that type, and it can't be a multimap.
+ */
+uint64_t chmap_add_u64(struct chmap * map, const void * key, const uint64_t delta);
+int64_t chmap_add_i64(struct chmap * map, const void * key, const int64_t delta);
+double chmap_add_f64(struct chmap * map, const void * key, const double delta);
+
+/**
+ * Adds each of `count` deltas of type `type`, packed in `deltas`, to the number stored under the matching
+ * key in `keys`. Keys are hashed and their slots prefetched a batch at a time, like the batched set
+ * functions. Returns how many keys were new to the map.
+ */
+size_t chmap_add_many(
+    struct chmap * map,
+    const void * keys,
+    const void * deltas,
+    const size_t count,
+    const enum chmap_number_type type
+);
+
+#ifdef __GNUC__
+/**
+ * Atomically adds `delta` to the number stored under `key`, for maps shared between threads. Keys are
+ * never inserted, since that would move other entries around: returns 1 if the key was there and has
+ * been updated, or 0 if it wasn't. Put every key in the map (with 0, say) before sharing it.
+ *
+ * Any number of threads may call these at once, as long as nothing else modifies the map. They may also
+ * run alongside `chmap_get`, but only on plain maps: on maps with tracing, a bounded capacity
+ * (`chmap_cache_new`) or expiry (`chmap_ttl_enable`), `chmap_get` itself writes to the map, so gets
+ * need a lock there. On maps with expiry, these remove expired entries too, so they need the lock as
+ * well. Front filters are fine. The updates aren't journaled, and CHMAP_STATS counters
+ * aren't kept exactly under contention.
+ */
+int chmap_atomic_add_u64(struct chmap * map, const void * key, const uint64_t delta);
+int chmap_atomic_add_i64(struct chmap * map, const void * key, const int64_t delta);
+int chmap_atomic_add_f64(struct chmap * map, const void * key, const double delta);
+#endif
+
+/**
+ * Builds the build side of a hash join over `count` keys of `key_size` bytes, packed in `keys`. Each key
+ * is stored with its row index, and repeated keys keep every row. With `partitions` set to 0, enough
+ * partitions are made that each fits in CHMAP_JOIN_CACHE_SIZE bytes; otherwise it's rounded up to a
+ * power of two.
+ */
+struct chmap_join * chmap_join_build(
+    const void * keys,
+    const size_t count,
+    const size_t key_size,
+    size_t partitions
+);
+
+/**
+ * Probes a join with `count` keys packed in `keys`, writing the row index pair of each match to
+ * `build_rows` and `probe_rows`, up to `capacity` pairs. Keys are hashed and their slots prefetched a
+ * batch at a time, and matched against the hashes the build side already stores.
+ *
+ * Probing resumes from `cursor`, and stops when the buffers are full: call it again with the same
+ * cursor until `cursor->row` reaches `count`. Returns the number of pairs written.
+ */
+size_t chmap_join_probe(
+    struct chmap_join * join,
+    const void * keys,
+    const size_t count,
+    struct chmap_join_cursor * cursor,
+    size_t * build_rows,
+    size_t * probe_rows,
+    const size_t capacity
+);
+
+/**
+ * Frees the join and all of its partitions.
+ */
+void chmap_join_free(struct chmap_join * join);
+
+/**
+ * Creates a map that holds at most `capacity` items, as a cache: once it's full, putting a new key evicts
+ * an item picked by `policy`. Puts and gets both count as uses. Eviction state is kept inside the map,
+ * so it costs no allocations past the map's own. The map is sized for `capacity` up front, so it never
+ * grows. A full cache stays full, so it gets twice as many slots as `capacity` rather than filling up to
+ * the usual maximum load, which keeps probes short for the evictions and inserts that follow.
+ *
+ * Bounded maps keep their items in the backing array, and aren't multimaps.
+ */
+struct chmap * chmap_cache_new(
+    const size_t item_size,
+    const size_t key_size,
+    const size_t capacity,
+    const enum chmap_evict_policy policy
+);
+
+/**
+ * Creates a bounded map like `chmap_cache_new`, holding as many items as fit in `max_bytes` of arrays.
+ * Returns NULL if not even one item fits.
+ */
+struct chmap * chmap_cache_new_bytes(
+    const size_t item_size,
+    const size_t key_size,
+    const size_t max_bytes,
+    const enum chmap_evict_policy policy
+);
+
+/**
+ * Shorthands for `chmap_cache_new` and `chmap_cache_new_bytes` with CHMAP_EVICT_LRU.
+ */
+struct chmap * chmap_lru_new(const size_t item_size, const size_t key_size, const size_t capacity);
+struct chmap * chmap_lru_new_bytes(const size_t item_size, const size_t key_size, const size_t max_bytes);
+
+/**
+ * Gets the hit, miss and eviction counters of a bounded map, or NULL if the map isn't one.
+ */
+const struct chmap_lru_counters * chmap_get_lru_counters(struct chmap * map);
+
+/**
+ * Lets entries in `map` expire, starting the clock at `now`. Time is in whatever unit the caller likes,
+ * as long as it only goes forward; the wheel moves one tick per unit. `on_expire`, if not NULL, is called
+ * with each item just before it's removed for expiring. Entries already in the map never expire unless
+ * given an expiry with `chmap_set_expiry`.
+ *
+ * Expired entries are removed lazily: once the clock set with `chmap_ttl_set_now` reaches an entry's
+ * expiry, gets, takes, puts, upserts, adds, counts, merges and `chmap_set_expiry` all remove it and carry
+ * on as though it were missing.
+ * `chmap_expire` removes all the rest.
+ *
+ * Returns -1 if expiry is already enabled, the map has CHMAP_INLINE_ITEMS or CHMAP_MULTIMAP, or it has a
+ * journal (`chmap_journal_open`), since journals don't record expiries.
+ */
+int chmap_ttl_enable(
+    struct chmap * map,
+    const uint64_t now,
+    void (*on_expire)(const void * item, void * ctx),
+    void * ctx
+);
+
+/**
+ * Moves the clock of `map` forward to `now`, without removing anything yet. Returns -1 if expiry isn't
+ * enabled on the map.
+ */
+int chmap_ttl_set_now(struct chmap * map, const uint64_t now);
+
+/**
+ * Puts `item` under `key` like `chmap_put`, expiring at `expires_at`, or never if that's 0. Putting with
+ * `chmap_put` keeps an existing entry's expiry. Returns -1 if expiry isn't enabled on the map.
+ */
+int chmap_put_ttl(struct chmap * map, const void * key, const void * item, const uint64_t expires_at);
+
+/**
+ * Sets when the entry under `key` expires, or makes it never expire with 0. Returns 1 if the key was
+ * there, 0 if not, or -1 if expiry isn't enabled on the map.
+ */
+int chmap_set_expiry(struct chmap * map, const void * key, const uint64_t expires_at);
+
+/**
+ * Moves the clock of `map` forward to `now`, and removes every entry that expired by then. Only the wheel
+ * slots between the last call and `now` are looked at, so this costs time in the number of expired
+ * entries and ticks passed, not in the size of the map. Returns the number of entries removed, which is
+ * always 0 if expiry isn't enabled on the map.
+ */
+size_t chmap_expire(struct chmap * map, const uint64_t now);
+
+/**
+ * Puts a blocked Bloom filter in front of `map`, built from the keys already in it, and spending
+ * `bits_per_key` bits per key, or CHMAP_FILTER_BITS_PER_KEY if that's 0. Every lookup checks the filter
+ * first, and a key the filter has never seen is reported missing after reading one cache line, instead
+ * of probing a cluster of the translation array. Worth it when most lookups miss.
+ *
+ * Puts keep the filter up to date. It's rebuilt whenever the map resizes, and once the keys deleted
+ * since it was built reach a quarter of the keys it was sized for.
+ *
+ * Returns -1 if the map already has a filter.
+ */
+int chmap_filter_enable(struct chmap * map, const size_t bits_per_key);
+
+/**
+ * Removes the front filter of `map`, if it has one.
+ */
+void chmap_filter_disable(struct chmap * map);
+
+/**
+ * Gets the counters of a map's front filter, or NULL if the map doesn't have one.
+ */
+const struct chmap_filter_counters * chmap_get_filter_counters(struct chmap * map);
+
 /**
  * Frees and totally deallocates the given map.
  */
 void chmap_free(struct chmap * map);
 
+/**
+ * Deletes every item in the map, but keeps its capacity, so refilling it doesn't have to grow it again.
+ */
+void chmap_clear(struct chmap * map);
+
+/**
+ * Grows the map, if needed, so that `additional` more items can be put into it without it growing again,
+ * and so without allocating.
+ */
+void chmap_reserve(struct chmap * map, const size_t additional);
+
+/**
+ * Puts every item of `src` into `dst`. Keys are matched by the hashes `src` already stores, so nothing is
+ * rehashed. When a key is in both maps, `policy` decides what happens:
+ * - `CHMAP_MERGE_OVERWRITE`: the item from `src` replaces the one in `dst`.
+ * - `CHMAP_MERGE_KEEP`: the item in `dst` is kept.
+ * - `CHMAP_MERGE_COMBINE`: `combine(dst_item, src_item, ctx)` is called to update the item in `dst`.
+ *
+ * Returns 0 on success, or -1 if the maps have different item or key sizes, or no `combine` was given
+ * for `CHMAP_MERGE_COMBINE`.
+ */
+int chmap_merge(
+    struct chmap * dst,
+    struct chmap * src,
+    const enum chmap_merge_policy policy,
+    void (*combine)(void * dst_item, const void * src_item, void * ctx),
+    void * ctx
+);
+
+/**
+ * Deletes every item for which `keep(item, ctx)` returns 0, in a single pass over the map. Entries that
+ * survive are shifted back over the removed ones as the pass goes, instead of once per deleted item.
+ * Returns the number of items deleted.
+ */
+size_t chmap_retain(
+    struct chmap * map,
+    int (*keep)(const void * item, void * ctx),
+    void * ctx
+);
+
+/**
+ * Creates an independent copy of the given map. Since the copy has the same capacity, its arrays are
+ * copied wholesale instead of rehashing every entry. The copy doesn't share the original's journal,
+ * grow hook or latency trace.
+ */
+struct chmap * chmap_clone(struct chmap * map);
+
+/**
+ * Makes `dst` an independent copy of `src`, reusing the memory `dst` already holds when the two have the
+ * same capacity. Meant for taking repeated snapshots without an allocation each time.
+ * Returns 0 on success, or -1 if the maps have different item or key sizes, different flags, or aren't
+ * both bounded maps of the same capacity and policy.
+ */
+int chmap_copy(struct chmap * dst, struct chmap * src);
+
+/**
+ * Builds an immutable copy of `map` for read-only lookups. The map itself is left untouched and can be
+ * freed. Returns `NULL` if no perfect hash could be found, which is vanishingly unlikely, or if `map`
+ * is a multimap.
+ */
+struct chmap_frozen * chmap_freeze(struct chmap * map);
+
+/**
+ * Gets a pointer to the item associated with `key` in a frozen map, or `NULL` if not found.
+ */
+void * chmap_frozen_get(const struct chmap_frozen * frozen, const void * key);
+
+/**
+ * Frees and totally deallocates the given frozen map.
+ */
+void chmap_frozen_free(struct chmap_frozen * frozen);
+
+/**
+ * Attaches an append-only journal at `path` to the map, so that it can be recovered after a crash.
+ *
+ * If the journal already exists, its records are replayed into the map first. After that, every `chmap_put`
+ * and `chmap_del` appends one record (the key's hash and, for puts, the item) and flushes it, so the cost of
+ * durability doesn't depend on how many slots the robinhood shifting touched. The journal is compacted
+ * automatically once it holds several times more records than the map holds entries.
+ *
+ * Define CHMAP_JOURNAL_FSYNC on POSIX systems to also fsync after every record; otherwise records survive
+ * the process dying, but not the machine.
+ *
+ * Returns 0 on success, or -1 if the journal couldn't be written, was written by a map with a different
+ * item or key size, or `map` is a multimap or has expiry (`chmap_ttl_enable`). Records don't hold expiries,
+ * so a recovered map would keep entries forever that should have expired.
+ */
+int chmap_journal_open(struct chmap * map, const char * path);
+
+/**
+ * Rewrites the map's journal so it holds exactly one record per entry. The new journal replaces the old one
+ * with a rename, so a crash during compaction leaves the old journal intact. Returns 0 on success, or -1.
+ */
+int chmap_journal_compact(struct chmap * map);
+
+/**
+ * Flushes and detaches the map's journal, if it has one. Returns -1 if any write to the journal failed.
+ */
+int chmap_journal_close(struct chmap * map);
+
+/* --- typed maps --- */
+
+// Typed maps start with this many slots, and always have a power of two of them.
+#define CHMAP_TYPED_INITIAL_SIZE 16
+
+/**
+ * A hash for integer keys in typed maps: the murmur3 finalizer, so that sequential keys spread out.
+ */
+static inline uint64_t chmap_hash_u64(uint64_t x) {
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+
+    return x;
+}
+
+// Key equality for typed maps whose keys can be compared with `==`.
+#define CHMAP_EQ(a, b) ((a) == (b))
+
+/**
+ * Defines `struct name`, a map from `KeyType` to `ValType`, along with these functions:
+ *
+ *   struct name * name_new(void);
+ *   int name_put(struct name * map, KeyType key, ValType val);    1 if `val` replaced an item, else 0
+ *   ValType * name_get(struct name * map, KeyType key);           NULL if `key` isn't in the map
+ *   int name_del(struct name * map, KeyType key);                 1 if `key` was in the map, else 0
+ *   void name_free(struct name * map);
+ *
+ * `hash_fn(key)` must give a uint64_t, and `eq_fn(a, b)` must be nonzero when two keys are equal; both
+ * can be functions or macros, like `chmap_hash_u64` and `CHMAP_EQ`.
+ *
+ * It's the same robinhood scheme as `struct chmap`, but with the key and item stored right in the slot,
+ * so that with their sizes known at compile time, copies are plain moves and the whole lookup can be
+ * inlined. Unlike `struct chmap`, typed maps store their keys and compare them with `eq_fn`, so `hash_fn`
+ * doesn't have to be collision free. Everything is `static inline`, so use it in as many files as needed.
+ */
+#define CHMAP_DEFINE(name, KeyType, ValType, hash_fn, eq_fn)                                            \
+    struct name##_slot {                                                                                \
+        KeyType key;                                                                                    \
+        ValType val;                                                                                    \
+        /* One more than the slot's distance from its key's home slot, or 0 if the slot is empty. */    \
+        uint32_t dist;                                                                                  \
+    };                                                                                                  \
+                                                                                                        \
+    struct name {                                                                                       \
+        size_t used_size;                                                                               \
+        size_t array_size;                                                                              \
+        struct name##_slot * slots;                                                                     \
+    };                                                                                                  \
+                                                                                                        \
+    static inline struct name * name##_new(void) {                                                      \
+        struct name * map = malloc(sizeof(struct name));                                                \
+                                                                                                        \
+        map->used_size = 0;                                                                             \
+        map->array_size = CHMAP_TYPED_INITIAL_SIZE;                                                     \
+        map->slots = calloc(CHMAP_TYPED_INITIAL_SIZE, sizeof(struct name##_slot));                      \
+                                                                                                        \
+        return map;                                                                                     \
+    }                                                                                                   \
+                                                                                                        \
+    static inline void name##_free(struct name * map) {                                                 \
+        free(map->slots);                                                                               \
+        free(map);                                                                                      \
+    }                                                                                                   \
+                                                                                                        \
+    /* Gets the slot holding `key`, or -1 if there isn't one. */                                        \
+    static inline ptrdiff_t name##_find(const struct name * map, const KeyType key) {                   \
+        const size_t mask = map->array_size - 1;                                                        \
+        size_t index = (size_t)hash_fn(key) & mask;                                                     \
+        uint32_t dist = 1;                                                                              \
+                                                                                                        \
+        /* Empty slots have a dist of 0, so this stops at them too. */                                  \
+        while (map->slots[index].dist >= dist) {                                                        \
+            if (map->slots[index].dist == dist && eq_fn(map->slots[index].key, key)) {                  \
+                return (ptrdiff_t)index;                                                                \
+            }                                                                                           \
+                                                                                                        \
+            index = (index + 1) & mask;                                                                 \
+            dist++;                                                                                     \
+        }                                                                                               \
+                                                                                                        \
+        return -1;                                                                                      \
+    }                                                                                                   \
+                                                                                                        \
+    static inline ValType * name##_get(struct name * map, const KeyType key) {                          \
+        const ptrdiff_t index = name##_find(map, key);                                                  \
+                                                                                                        \
+        return index >= 0 ? &map->slots[index].val : NULL;                                              \
+    }                                                                                                   \
+                                                                                                        \
+    /* Puts a key that isn't in the map yet, robinhood swapping it forward. */                          \
+    static inline void name##_insert(struct name * map, struct name##_slot carry) {                     \
+        const size_t mask = map->array_size - 1;                                                        \
+        size_t index = (size_t)hash_fn(carry.key) & mask;                                               \
+                                                                                                        \
+        carry.dist = 1;                                                                                 \
+                                                                                                        \
+        while (map->slots[index].dist != 0) {                                                           \
+            if (map->slots[index].dist < carry.dist) {                                                  \
+                struct name##_slot richer = map->slots[index];                                          \
+                map->slots[index] = carry;                                                              \
+                carry = richer;                                                                         \
+            }                                                                                           \
+                                                                                                        \
+            index = (index + 1) & mask;                                                                 \
+            carry.dist++;                                                                               \
+        }                                                                                               \
+                                                                                                        \
+        map->slots[index] = carry;                                                                      \
+        map->used_size++;                                                                               \
+    }                                                                                                   \
+                                                                                                        \
+    static inline void name##_grow(struct name * map) {                                                 \
+        struct name##_slot * old_slots = map->slots;                                                    \
+        const size_t old_size = map->array_size;                                                        \
+                                                                                                        \
+        map->array_size = old_size * 2;                                                                 \
+        map->slots = calloc(map->array_size, sizeof(struct name##_slot));                               \
+        map->used_size = 0;                                                                             \
+                                                                                                        \
+        for (size_t i = 0; i < old_size; i++) {                                                         \
+            if (old_slots[i].dist != 0) {                                                               \
+                name##_insert(map, old_slots[i]);                                                       \
+            }                                                                                           \
+        }                                                                                               \
+                                                                                                        \
+        free(old_slots);                                                                                \
+    }                                                                                                   \
+                                                                                                        \
+    static inline int name##_put(struct name * map, const KeyType key, const ValType val) {             \
+        ValType * existing = name##_get(map, key);                                                      \
+                                                                                                        \
+        if (existing != NULL) {                                                                         \
+            *existing = val;                                                                            \
+            return 1;                                                                                   \
+        }                                                                                               \
+                                                                                                        \
+        /* Grow past 90% full, like `struct chmap` does. */                                             \
+        if ((map->used_size + 1) * 10 > map->array_size * 9) {                                          \
+            name##_grow(map);                                                                           \
+        }                                                                                               \
+                                                                                                        \
+        struct name##_slot slot;                                                                        \
+        slot.key = key;                                                                                 \
+        slot.val = val;                                                                                 \
+        name##_insert(map, slot);                                                                       \
+                                                                                                        \
+        return 0;                                                                                       \
+    }                                                                                                   \
+                                                                                                        \
+    static inline int name##_del(struct name * map, const KeyType key) {                                \
+        const size_t mask = map->array_size - 1;                                                        \
+        const ptrdiff_t found = name##_find(map, key);                                                  \
+                                                                                                        \
+        if (found < 0) {                                                                                \
+            return 0;                                                                                   \
+        }                                                                                               \
+                                                                                                        \
+        /* Shift the rest of the cluster back, up to an empty slot or one that's already home. */       \
+        size_t index = (size_t)found;                                                                   \
+        size_t next = (index + 1) & mask;                                                               \
+                                                                                                        \
+        while (map->slots[next].dist > 1) {                                                             \
+            map->slots[index] = map->slots[next];                                                       \
+            map->slots[index].dist--;                                                                   \
+            index = next;                                                                               \
+            next = (next + 1) & mask;                                                                   \
+        }                                                                                               \
+                                                                                                        \
+        map->slots[index].dist = 0;                                                                     \
+        map->used_size--;                                                                               \
+                                                                                                        \
+        return 1;                                                                                       \
+    }
+
 void debug_map(struct chmap * map);
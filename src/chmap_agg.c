@@ -0,0 +1,287 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chmap.h"
+#include "chmap_agg.h"
+
+/**
+ * What every aggregation thread is given: the input, and the thread-local maps of every thread, with
+ * thread `t`'s map for partition `p` at `locals[t * partition_count + p]`.
+ */
+struct agg_run {
+    const void * keys;
+    const void * values;
+    size_t count;
+    size_t ksize;
+    size_t isize;
+    void (*combine)(void * acc, const void * value, void * ctx);
+    void * ctx;
+    size_t thread_count;
+    size_t partition_count;
+    struct chmap ** locals;
+    struct chmap ** partitions;
+};
+
+struct agg_thread {
+    struct agg_run * run;
+    size_t index;
+};
+
+/**
+ * Which partition a hash goes to. The top bits are used, since the bottom ones pick home slots within
+ * each partition's map. `partition_count` is a power of two.
+ */
+static size_t agg_partition(const uint64_t hash, const size_t partition_count) {
+    return (size_t)(hash >> 32) & (partition_count - 1);
+}
+
+/**
+ * Creates a map to aggregate into. Items small enough to fit in the slots are kept there, so that
+ * folding a row in touches a single cache line.
+ */
+static struct chmap * agg_map_new(const size_t isize, const size_t ksize) {
+    return chmap_new_flags(isize, ksize, CHMAP_INLINE_ITEMS);
+}
+
+/**
+ * Folds this thread's share of the rows into its own maps.
+ */
+static void * agg_build(void * arg) {
+    struct agg_thread * thread = arg;
+    struct agg_run * run = thread->run;
+    struct chmap ** locals = &run->locals[thread->index * run->partition_count];
+    const size_t start = run->count * thread->index / run->thread_count;
+    const size_t end = run->count * (thread->index + 1) / run->thread_count;
+
+    for (size_t i = start; i < end; i++) {
+        const void * key = (const char *)run->keys + i * run->ksize;
+        const void * value = (const char *)run->values + i * run->isize;
+        const uint64_t hash = chmap_hash_key(key, run->ksize);
+        const size_t partition = agg_partition(hash, run->partition_count);
+        int inserted;
+
+        if (locals[partition] == NULL) {
+            locals[partition] = agg_map_new(run->isize, run->ksize);
+        }
+
+        void * acc = chmap_upsert_hashed(locals[partition], hash, &inserted);
+
+        if (inserted) {
+            memcpy(acc, value, run->isize);
+        } else {
+            run->combine(acc, value, run->ctx);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Merges every thread's map of each of this thread's partitions into one. Each partition is only
+ * touched by one thread, so this doesn't need locks either.
+ */
+static void * agg_merge(void * arg) {
+    struct agg_thread * thread = arg;
+    struct agg_run * run = thread->run;
+
+    for (size_t p = thread->index; p < run->partition_count; p += run->thread_count) {
+        struct chmap * largest = NULL;
+
+        // Merging into the largest map moves the fewest entries.
+        for (size_t t = 0; t < run->thread_count; t++) {
+            struct chmap * local = run->locals[t * run->partition_count + p];
+
+            if (local != NULL && (largest == NULL || local->used_size > largest->used_size)) {
+                largest = local;
+            }
+        }
+
+        if (largest == NULL) {
+            run->partitions[p] = agg_map_new(run->isize, run->ksize);
+            continue;
+        }
+
+        for (size_t t = 0; t < run->thread_count; t++) {
+            struct chmap * local = run->locals[t * run->partition_count + p];
+
+            if (local != NULL && local != largest) {
+                chmap_merge(largest, local, CHMAP_MERGE_COMBINE, run->combine, run->ctx);
+                chmap_free(local);
+            }
+        }
+
+        run->partitions[p] = largest;
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs `phase` on every thread and waits for all of them. The calling thread does the first share itself,
+ * and any share that can't get a thread of its own.
+ */
+static void agg_parallel(
+    struct agg_run * run,
+    struct agg_thread * threads,
+    pthread_t * ids,
+    void * (*phase)(void *)
+) {
+    unsigned char * started = calloc(run->thread_count, 1);
+
+    for (size_t t = 1; started != NULL && t < run->thread_count; t++) {
+        started[t] = pthread_create(&ids[t], NULL, phase, &threads[t]) == 0;
+    }
+
+    for (size_t t = 0; t < run->thread_count; t++) {
+        if (started == NULL || !started[t]) {
+            phase(&threads[t]);
+        }
+    }
+
+    for (size_t t = 1; started != NULL && t < run->thread_count; t++) {
+        if (started[t]) {
+            pthread_join(ids[t], NULL);
+        }
+    }
+
+    free(started);
+}
+
+/**
+ * Gets the size of the L2 cache, or CHMAP_AGG_CACHE_SIZE if it isn't known.
+ */
+static size_t agg_cache_size(void) {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    const long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+    if (size > 0) {
+        return (size_t)size;
+    }
+#endif
+
+    return CHMAP_AGG_CACHE_SIZE;
+}
+
+size_t chmap_agg_fanout(const size_t groups, const size_t item_size, const size_t threads) {
+    // A slot for every group, with room for the load factor, plus the item if it isn't stored inline.
+    const size_t item_bytes = item_size > CHMAP_INLINE_MAX_SIZE ? item_size : 0;
+    const size_t group_bytes = 2 * sizeof(struct entry) + item_bytes;
+    const size_t needed = groups * group_bytes / agg_cache_size() + 1;
+    size_t partitions = 1;
+
+    while (partitions < CHMAP_AGG_MAX_PARTITIONS && (partitions < needed || partitions < threads)) {
+        partitions *= 2;
+    }
+
+    return partitions;
+}
+
+struct chmap_agg * chmap_agg_run(
+    const void * keys,
+    const void * values,
+    const size_t count,
+    const size_t key_size,
+    const size_t item_size,
+    void (*combine)(void * acc, const void * value, void * ctx),
+    void * ctx,
+    size_t threads,
+    size_t partitions
+) {
+    if (threads == 0) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t)online : 1;
+    }
+
+    if (partitions == 0) {
+        partitions = chmap_agg_fanout(count, item_size, threads);
+    }
+
+    size_t partition_count = 1;
+
+    while (partition_count < partitions) {
+        partition_count *= 2;
+    }
+
+    struct chmap_agg * agg = malloc(sizeof(struct chmap_agg));
+    struct agg_thread * agg_threads = malloc(threads * sizeof(struct agg_thread));
+    pthread_t * ids = malloc(threads * sizeof(pthread_t));
+    struct agg_run run = {
+        .keys = keys,
+        .values = values,
+        .count = count,
+        .ksize = key_size,
+        .isize = item_size,
+        .combine = combine,
+        .ctx = ctx,
+        .thread_count = threads,
+        .partition_count = partition_count,
+        .locals = calloc(threads * partition_count, sizeof(struct chmap *)),
+        .partitions = calloc(partition_count, sizeof(struct chmap *)),
+    };
+
+    if (agg == NULL || agg_threads == NULL || ids == NULL || run.locals == NULL || run.partitions == NULL) {
+        free(agg);
+        free(agg_threads);
+        free(ids);
+        free(run.locals);
+        free(run.partitions);
+        return NULL;
+    }
+
+    for (size_t t = 0; t < threads; t++) {
+        agg_threads[t].run = &run;
+        agg_threads[t].index = t;
+    }
+
+    agg_parallel(&run, agg_threads, ids, agg_build);
+    agg_parallel(&run, agg_threads, ids, agg_merge);
+
+    free(agg_threads);
+    free(ids);
+    free(run.locals);
+
+    agg->partition_count = partition_count;
+    agg->partitions = run.partitions;
+
+    return agg;
+}
+
+void * chmap_agg_get(struct chmap_agg * agg, const void * key) {
+    const uint64_t hash = chmap_hash(agg->partitions[0], key);
+
+    return chmap_get_hashed(agg->partitions[agg_partition(hash, agg->partition_count)], hash);
+}
+
+struct chmap * chmap_agg_merge(struct chmap_agg * agg) {
+    struct chmap * first = agg->partitions[0];
+    size_t total = 0;
+
+    for (size_t p = 0; p < agg->partition_count; p++) {
+        total += agg->partitions[p]->used_size;
+    }
+
+    struct chmap * map = agg_map_new(first->isize, first->ksize);
+
+    chmap_reserve(map, total);
+
+    for (size_t p = 0; p < agg->partition_count; p++) {
+        chmap_merge(map, agg->partitions[p], CHMAP_MERGE_OVERWRITE, NULL, NULL);
+    }
+
+    chmap_agg_free(agg);
+
+    return map;
+}
+
+void chmap_agg_free(struct chmap_agg * agg) {
+    for (size_t p = 0; p < agg->partition_count; p++) {
+        chmap_free(agg->partitions[p]);
+    }
+
+    free(agg->partitions);
+    free(agg);
+}
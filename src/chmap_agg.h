@@ -0,0 +1,67 @@
+#pragma once
+#include <stddef.h>
+
+#include "chmap.h"
+
+// Partition fan-out is picked so that each partition's map fits in a cache of this many bytes, when the
+// real cache size can't be asked for.
+#define CHMAP_AGG_CACHE_SIZE (256 * 1024)
+
+// More partitions than this cost more in scattered writes than they save in cache misses.
+#define CHMAP_AGG_MAX_PARTITIONS 256
+
+/**
+ * The result of a parallel aggregation: one map per partition. Keys are split between partitions by the
+ * top bits of their hashes, so every key is in exactly one of them.
+ */
+struct chmap_agg {
+    size_t partition_count;
+    struct chmap ** partitions;
+};
+
+/**
+ * Aggregates `count` rows, where row `i` is the key at `keys + i * key_size` and the value at
+ * `values + i * item_size`, grouping by key. The first value seen for a key is copied in as is, and later
+ * ones are folded in with `combine(acc, value, ctx)`. `combine` must be associative and commutative, since
+ * rows are folded in any order, and it's also used to fold partial results together.
+ *
+ * Each of `threads` threads aggregates its share of the rows into thread-local maps, one per partition,
+ * so no locks are taken. Then the threads each merge the thread-local maps of some partitions together.
+ * `threads` can be 0 to use one thread per online processor, and `partitions` can be 0 to choose the
+ * fan-out with `chmap_agg_fanout`, assuming every key is different. It's rounded up to a power of two.
+ *
+ * Returns NULL if the partition tables couldn't be allocated.
+ */
+struct chmap_agg * chmap_agg_run(
+    const void * keys,
+    const void * values,
+    const size_t count,
+    const size_t key_size,
+    const size_t item_size,
+    void (*combine)(void * acc, const void * value, void * ctx),
+    void * ctx,
+    size_t threads,
+    size_t partitions
+);
+
+/**
+ * Picks how many partitions to aggregate `groups` distinct keys into with `threads` threads: enough that
+ * every partition's map fits in the L2 cache, and at least one per thread so the merge runs in parallel.
+ */
+size_t chmap_agg_fanout(const size_t groups, const size_t item_size, const size_t threads);
+
+/**
+ * Gets the aggregated value for `key`, or NULL if no row had that key.
+ */
+void * chmap_agg_get(struct chmap_agg * agg, const void * key);
+
+/**
+ * Moves every partition into a single map, and frees `agg`. Since partitions share no keys, nothing is
+ * combined.
+ */
+struct chmap * chmap_agg_merge(struct chmap_agg * agg);
+
+/**
+ * Frees the aggregation and all of its partitions.
+ */
+void chmap_agg_free(struct chmap_agg * agg);
@@ -0,0 +1,152 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+#include <stdio.h>
+
+#define JOURNAL_PATH "test_chmap_add.tmp"
+
+void setUp(void) {
+    remove(JOURNAL_PATH);
+}
+
+void tearDown(void) {
+    remove(JOURNAL_PATH);
+}
+
+
+void chmap_add_starts_from_zero(void) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(int));
+
+    for (int key = 0; key < 1000; key++) {
+        TEST_ASSERT_EQUAL_UINT64(key, chmap_add_u64(map, &key, key));
+    }
+
+    for (int key = 0; key < 1000; key++) {
+        TEST_ASSERT_EQUAL_UINT64(key + 5, chmap_add_u64(map, &key, 5));
+        TEST_ASSERT_EQUAL_UINT64(key + 5, *(uint64_t *)chmap_get(map, &key));
+    }
+
+    TEST_ASSERT_EQUAL_size_t(1000, map->used_size);
+
+    chmap_free(map);
+}
+
+void chmap_add_signed_and_float(void) {
+    struct chmap * map = chmap_new(sizeof(int64_t), sizeof(int));
+    int key = 1;
+
+    TEST_ASSERT_EQUAL_INT64(-3, chmap_add_i64(map, &key, -3));
+    TEST_ASSERT_EQUAL_INT64(4, chmap_add_i64(map, &key, 7));
+    TEST_ASSERT_EQUAL_INT64(INT64_MIN, chmap_add_i64(map, &key, INT64_MAX - 3));
+
+    key = 2;
+    TEST_ASSERT_TRUE(chmap_add_f64(map, &key, 0.5) == 0.5);
+    TEST_ASSERT_TRUE(chmap_add_f64(map, &key, -2.25) == -1.75);
+
+    chmap_free(map);
+}
+
+void chmap_add_inline(void) {
+    struct chmap * map = chmap_new_flags(sizeof(uint64_t), sizeof(int), CHMAP_INLINE_ITEMS);
+
+    for (int i = 0; i < 3000; i++) {
+        int key = i % 100;
+        chmap_add_u64(map, &key, 1);
+    }
+
+    for (int key = 0; key < 100; key++) {
+        TEST_ASSERT_EQUAL_UINT64(30, *(uint64_t *)chmap_get(map, &key));
+    }
+
+    chmap_free(map);
+}
+
+void chmap_add_many_batched(void) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(int));
+    int keys[1000];
+    uint64_t deltas[1000];
+    double fdeltas[1000];
+
+    for (int i = 0; i < 1000; i++) {
+        keys[i] = i % 300;
+        deltas[i] = i;
+        fdeltas[i] = 0.5;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(300, chmap_add_many(map, keys, deltas, 1000, CHMAP_U64));
+    TEST_ASSERT_EQUAL_size_t(0, chmap_add_many(map, keys, deltas, 1000, CHMAP_U64));
+
+    for (int key = 0; key < 300; key++) {
+        uint64_t expected = 0;
+
+        for (int i = key; i < 1000; i += 300) {
+            expected += 2 * (uint64_t)i;
+        }
+
+        TEST_ASSERT_EQUAL_UINT64(expected, *(uint64_t *)chmap_get(map, &key));
+    }
+
+    chmap_free(map);
+
+    map = chmap_new(sizeof(double), sizeof(int));
+    chmap_add_many(map, keys, fdeltas, 1000, CHMAP_F64);
+
+    int key = 0;
+    TEST_ASSERT_TRUE(*(double *)chmap_get(map, &key) == 2.0);
+    key = 299;
+    TEST_ASSERT_TRUE(*(double *)chmap_get(map, &key) == 1.5);
+
+    chmap_free(map);
+}
+
+void chmap_add_journal_recovers(void) {
+    struct chmap * map = chmap_new(sizeof(int64_t), sizeof(int));
+    chmap_journal_open(map, JOURNAL_PATH);
+
+    for (int i = 0; i < 500; i++) {
+        int key = i % 50;
+        chmap_add_i64(map, &key, -1);
+    }
+
+    chmap_free(map);
+
+    struct chmap * recovered = chmap_new(sizeof(int64_t), sizeof(int));
+    TEST_ASSERT_EQUAL_INT(0, chmap_journal_open(recovered, JOURNAL_PATH));
+
+    for (int key = 0; key < 50; key++) {
+        TEST_ASSERT_EQUAL_INT64(-10, *(int64_t *)chmap_get(recovered, &key));
+    }
+
+    chmap_free(recovered);
+}
+
+void chmap_atomic_add_existing_only(void) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(int));
+    int key = 7;
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_atomic_add_u64(map, &key, 1));
+    TEST_ASSERT_NULL(chmap_get(map, &key));
+
+    chmap_add_u64(map, &key, 0);
+
+    TEST_ASSERT_EQUAL_INT(1, chmap_atomic_add_u64(map, &key, 3));
+    TEST_ASSERT_EQUAL_INT(1, chmap_atomic_add_i64(map, &key, -1));
+    TEST_ASSERT_EQUAL_UINT64(2, *(uint64_t *)chmap_get(map, &key));
+
+    key = 8;
+    chmap_add_f64(map, &key, 1.0);
+    TEST_ASSERT_EQUAL_INT(1, chmap_atomic_add_f64(map, &key, 0.25));
+    TEST_ASSERT_TRUE(*(double *)chmap_get(map, &key) == 1.25);
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_add_starts_from_zero);
+    RUN_TEST(chmap_add_signed_and_float);
+    RUN_TEST(chmap_add_inline);
+    RUN_TEST(chmap_add_many_batched);
+    RUN_TEST(chmap_add_journal_recovers);
+    RUN_TEST(chmap_atomic_add_existing_only);
+    return UNITY_END();
+}
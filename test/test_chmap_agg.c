@@ -0,0 +1,148 @@
+#define CHMAP_AGG
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+#define ROWS 100000
+#define GROUPS 1000
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static void add_u64s(void * acc, const void * value, void * ctx) {
+    (void)ctx;
+
+    *(uint64_t *)acc += *(const uint64_t *)value;
+}
+
+static uint64_t keys[ROWS];
+static uint64_t values[ROWS];
+
+/**
+ * Fills the rows so that group `g` gets ROWS / GROUPS rows, each with the value `g`.
+ */
+static void fill_rows(void) {
+    for (size_t i = 0; i < ROWS; i++) {
+        keys[i] = i % GROUPS;
+        values[i] = i % GROUPS;
+    }
+}
+
+static void check_sums(struct chmap_agg * agg) {
+    size_t total = 0;
+
+    for (size_t p = 0; p < agg->partition_count; p++) {
+        total += agg->partitions[p]->used_size;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(GROUPS, total);
+
+    for (uint64_t key = 0; key < GROUPS; key++) {
+        uint64_t * sum = chmap_agg_get(agg, &key);
+
+        TEST_ASSERT_NOT_NULL(sum);
+        TEST_ASSERT_EQUAL_UINT64(key * (ROWS / GROUPS), *sum);
+    }
+
+    const uint64_t missing = GROUPS;
+    TEST_ASSERT_NULL(chmap_agg_get(agg, &missing));
+}
+
+void chmap_agg_single_thread(void) {
+    fill_rows();
+
+    struct chmap_agg * agg = chmap_agg_run(keys, values, ROWS, sizeof(uint64_t), sizeof(uint64_t),
+                                           add_u64s, NULL, 1, 1);
+
+    TEST_ASSERT_EQUAL_size_t(1, agg->partition_count);
+    check_sums(agg);
+
+    chmap_agg_free(agg);
+}
+
+void chmap_agg_many_threads(void) {
+    fill_rows();
+
+    // More threads than partitions, and rows that don't split evenly between threads.
+    struct chmap_agg * agg = chmap_agg_run(keys, values, ROWS - 1, sizeof(uint64_t), sizeof(uint64_t),
+                                           add_u64s, NULL, 7, 4);
+
+    TEST_ASSERT_EQUAL_size_t(4, agg->partition_count);
+
+    const uint64_t last = (ROWS - 1) % GROUPS;
+    TEST_ASSERT_EQUAL_UINT64(last * (ROWS / GROUPS - 1), *(uint64_t *)chmap_agg_get(agg, &last));
+
+    chmap_agg_free(agg);
+
+    agg = chmap_agg_run(keys, values, ROWS, sizeof(uint64_t), sizeof(uint64_t), add_u64s, NULL, 8, 64);
+
+    TEST_ASSERT_EQUAL_size_t(64, agg->partition_count);
+    check_sums(agg);
+
+    chmap_agg_free(agg);
+}
+
+void chmap_agg_partitions_are_disjoint(void) {
+    fill_rows();
+
+    struct chmap_agg * agg = chmap_agg_run(keys, values, ROWS, sizeof(uint64_t), sizeof(uint64_t),
+                                           add_u64s, NULL, 4, 16);
+
+    for (uint64_t key = 0; key < GROUPS; key++) {
+        size_t found = 0;
+
+        for (size_t p = 0; p < agg->partition_count; p++) {
+            found += chmap_get(agg->partitions[p], &key) != NULL;
+        }
+
+        TEST_ASSERT_EQUAL_size_t(1, found);
+    }
+
+    chmap_agg_free(agg);
+}
+
+void chmap_agg_merges_into_one_map(void) {
+    fill_rows();
+
+    struct chmap_agg * agg = chmap_agg_run(keys, values, ROWS, sizeof(uint64_t), sizeof(uint64_t),
+                                           add_u64s, NULL, 4, 0);
+    struct chmap * map = chmap_agg_merge(agg);
+
+    TEST_ASSERT_EQUAL_size_t(GROUPS, map->used_size);
+
+    for (uint64_t key = 0; key < GROUPS; key++) {
+        TEST_ASSERT_EQUAL_UINT64(key * (ROWS / GROUPS), *(uint64_t *)chmap_get(map, &key));
+    }
+
+    chmap_free(map);
+}
+
+void chmap_agg_empty_input(void) {
+    struct chmap_agg * agg = chmap_agg_run(keys, values, 0, sizeof(uint64_t), sizeof(uint64_t),
+                                           add_u64s, NULL, 3, 2);
+    const uint64_t key = 0;
+
+    TEST_ASSERT_NULL(chmap_agg_get(agg, &key));
+
+    chmap_agg_free(agg);
+}
+
+void chmap_agg_fanout_fits_cache(void) {
+    TEST_ASSERT_EQUAL_size_t(8, chmap_agg_fanout(10, sizeof(uint64_t), 8));
+    TEST_ASSERT_EQUAL_size_t(1, chmap_agg_fanout(10, sizeof(uint64_t), 1));
+    TEST_ASSERT_EQUAL_size_t(CHMAP_AGG_MAX_PARTITIONS, chmap_agg_fanout(SIZE_MAX / 1024, 64, 1));
+
+    // More groups never means fewer partitions.
+    TEST_ASSERT_TRUE(chmap_agg_fanout(10000000, sizeof(uint64_t), 1) >= chmap_agg_fanout(1000, sizeof(uint64_t), 1));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_agg_single_thread);
+    RUN_TEST(chmap_agg_many_threads);
+    RUN_TEST(chmap_agg_partitions_are_disjoint);
+    RUN_TEST(chmap_agg_merges_into_one_map);
+    RUN_TEST(chmap_agg_empty_input);
+    RUN_TEST(chmap_agg_fanout_fits_cache);
+    return UNITY_END();
+}
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+
+// unity_memory hands every allocation it tracks to these, so they see exactly what chmap asks the heap for.
+#define UNITY_MALLOC counted_malloc
+#define UNITY_FREE counted_free
+
+static size_t allocations;
+
+void * counted_malloc(size_t size) {
+    allocations++;
+    return malloc(size);
+}
+
+void counted_free(void * ptr) {
+    free(ptr);
+}
+
+#include "../unity/src/unity.h"
+#include "../unity/src/unity_memory.h"
+#include "../chmap_onefile.h"
+
+// chmap_new allocates the map itself, its translation array, backing array and backing array index stack.
+#define ALLOCATIONS_PER_MAP 4
+
+// Growing replaces the translation array, backing array and backing array index stack.
+#define ALLOCATIONS_PER_GROW 3
+
+void setUp(void) {
+    UnityMalloc_StartTest();
+}
+
+void tearDown(void) {
+    UnityMalloc_EndTest();
+}
+
+
+/**
+ * Makes a map holding `count` items that can take `headroom` more without growing.
+ */
+static struct chmap * filled_map(const int count, const size_t headroom) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    chmap_reserve(map, count + headroom);
+
+    for (int key = 0; key < count; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    return map;
+}
+
+void chmap_new_allocates_fixed_blocks(void) {
+    allocations = 0;
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    TEST_ASSERT_EQUAL_size_t(ALLOCATIONS_PER_MAP, allocations);
+
+    chmap_free(map);
+}
+
+void chmap_get_does_not_allocate(void) {
+    struct chmap * map = filled_map(1000, 0);
+
+    allocations = 0;
+
+    for (int key = 0; key < 2000; key++) {
+        chmap_get(map, &key);
+        chmap_get_hashed(map, chmap_hash(map, &key));
+    }
+
+    TEST_ASSERT_EQUAL_size_t(0, allocations);
+
+    chmap_free(map);
+}
+
+void chmap_put_without_growth_does_not_allocate(void) {
+    struct chmap * map = filled_map(1000, 1000);
+    const size_t array_size = map->array_size;
+
+    allocations = 0;
+
+    for (int key = 0; key < 2000; key++) {
+        int val = -key;
+
+        chmap_put(map, &key, &val);
+    }
+
+    for (int key = 0; key < 2000; key++) {
+        *(int *)chmap_upsert(map, &key, NULL) += 1;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(array_size, map->array_size);
+    TEST_ASSERT_EQUAL_size_t(0, allocations);
+
+    chmap_free(map);
+}
+
+void chmap_del_does_not_allocate(void) {
+    struct chmap * map = filled_map(1000, 0);
+    int out;
+
+    allocations = 0;
+
+    for (int key = 0; key < 1000; key += 2) {
+        chmap_del(map, &key);
+    }
+
+    for (int key = 1; key < 1000; key += 2) {
+        chmap_take(map, &key, &out);
+    }
+
+    chmap_del(map, &out);
+
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+    TEST_ASSERT_EQUAL_size_t(0, allocations);
+
+    chmap_free(map);
+}
+
+void chmap_steady_churn_does_not_allocate(void) {
+    struct chmap * map = filled_map(1000, 0);
+
+    allocations = 0;
+
+    // Deleting and re-putting recycles backing array slots instead of asking for new ones.
+    for (int round = 0; round < 10; round++) {
+        for (int key = 0; key < 1000; key++) {
+            chmap_del(map, &key);
+            chmap_put(map, &key, &round);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(0, allocations);
+
+    chmap_free(map);
+}
+
+void chmap_growth_allocates_expected_blocks(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    allocations = 0;
+
+    for (int key = 0; key < 10000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_TRUE(map->grow_count > 0);
+    TEST_ASSERT_EQUAL_size_t(map->grow_count * ALLOCATIONS_PER_GROW, allocations);
+
+    allocations = 0;
+    chmap_reserve(map, 100000);
+
+    TEST_ASSERT_EQUAL_size_t(ALLOCATIONS_PER_GROW, allocations);
+
+    chmap_free(map);
+}
+
+void chmap_inline_items_allocate_only_the_translation_array(void) {
+    allocations = 0;
+    struct chmap * map = chmap_new_flags(sizeof(int), sizeof(int), CHMAP_INLINE_ITEMS);
+
+    TEST_ASSERT_EQUAL_size_t(2, allocations);
+
+    allocations = 0;
+
+    for (int key = 0; key < 10000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(map->grow_count, allocations);
+
+    chmap_free(map);
+}
+
+void chmap_tracing_does_not_allocate_per_operation(void) {
+    struct chmap * map = filled_map(1000, 1000);
+
+    chmap_trace_enable(map);
+    allocations = 0;
+
+    for (int key = 1000; key < 2000; key++) {
+        chmap_put(map, &key, &key);
+        chmap_get(map, &key);
+        chmap_del(map, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(0, allocations);
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_new_allocates_fixed_blocks);
+    RUN_TEST(chmap_get_does_not_allocate);
+    RUN_TEST(chmap_put_without_growth_does_not_allocate);
+    RUN_TEST(chmap_del_does_not_allocate);
+    RUN_TEST(chmap_steady_churn_does_not_allocate);
+    RUN_TEST(chmap_growth_allocates_expected_blocks);
+    RUN_TEST(chmap_inline_items_allocate_only_the_translation_array);
+    RUN_TEST(chmap_tracing_does_not_allocate_per_operation);
+    return UNITY_END();
+}
@@ -0,0 +1,101 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static void fill(struct chmap * map, const int count, const int offset) {
+    for (int key = 0; key < count; key++) {
+        int val = key + offset;
+
+        chmap_put(map, &key, &val);
+    }
+}
+
+static void assert_filled(struct chmap * map, const int count, const int offset) {
+    TEST_ASSERT_EQUAL_size_t(count, map->used_size);
+
+    for (int key = 0; key < count; key++) {
+        const int * got = chmap_get(map, &key);
+
+        TEST_ASSERT_NOT_NULL(got);
+        TEST_ASSERT_EQUAL_INT(key + offset, *got);
+    }
+}
+
+void chmap_clear_full_map_keeps_capacity(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    fill(map, 1000, 0);
+
+    const size_t capacity = map->array_size;
+
+    chmap_clear(map);
+
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+    TEST_ASSERT_EQUAL_size_t(capacity, map->array_size);
+
+    for (int key = 0; key < 1000; key++) {
+        TEST_ASSERT_NULL(chmap_get(map, &key));
+    }
+
+    fill(map, 1000, 5);
+
+    TEST_ASSERT_EQUAL_size_t(capacity, map->array_size);
+    assert_filled(map, 1000, 5);
+
+    chmap_free(map);
+}
+
+void chmap_clear_sparse_map(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    fill(map, 1000, 0);
+
+    for (int key = 10; key < 1000; key++) {
+        chmap_del(map, &key);
+    }
+
+    chmap_clear(map);
+
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+
+    for (int key = 0; key < 10; key++) {
+        TEST_ASSERT_NULL(chmap_get(map, &key));
+    }
+
+    fill(map, 1000, 7);
+    assert_filled(map, 1000, 7);
+
+    chmap_free(map);
+}
+
+void chmap_clear_repeatedly(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int round = 0; round < 50; round++) {
+        fill(map, round * 10, round);
+        assert_filled(map, round * 10, round);
+        chmap_clear(map);
+    }
+
+    chmap_free(map);
+}
+
+void chmap_clear_empty(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    chmap_clear(map);
+
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_clear_full_map_keeps_capacity);
+    RUN_TEST(chmap_clear_sparse_map);
+    RUN_TEST(chmap_clear_repeatedly);
+    RUN_TEST(chmap_clear_empty);
+    return UNITY_END();
+}
@@ -0,0 +1,136 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static int has_key(struct chmap * map, int key) {
+    // Gets count as uses, so look without setting reference bits.
+    return find_hash(map, chmap_hash(map, &key)) != map->array_size;
+}
+
+void chmap_clock_gives_second_chances(void) {
+    struct chmap * map = chmap_cache_new(sizeof(int), sizeof(int), 3, CHMAP_EVICT_CLOCK);
+
+    for (int key = 0; key < 3; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    // 0 is referenced, so the hand clears its bit and passes it, and evicts 1 instead.
+    int key = 0;
+    TEST_ASSERT_EQUAL_INT(0, *(int *)chmap_get(map, &key));
+
+    key = 3;
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_TRUE(has_key(map, 0));
+    TEST_ASSERT_FALSE(has_key(map, 1));
+    TEST_ASSERT_TRUE(has_key(map, 2));
+
+    // The hand moved on from 1, so 2 is next, and 0's second chance is used up after that.
+    key = 4;
+    chmap_put(map, &key, &key);
+    key = 5;
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_FALSE(has_key(map, 2));
+    TEST_ASSERT_FALSE(has_key(map, 0));
+    TEST_ASSERT_TRUE(has_key(map, 3));
+    TEST_ASSERT_TRUE(has_key(map, 4));
+    TEST_ASSERT_TRUE(has_key(map, 5));
+
+    const struct chmap_lru_counters * counters = chmap_get_lru_counters(map);
+
+    TEST_ASSERT_EQUAL_size_t(3, counters->evictions);
+    TEST_ASSERT_EQUAL_size_t(0, counters->hits);
+    TEST_ASSERT_EQUAL_size_t(0, counters->misses);
+
+    chmap_free(map);
+}
+
+void chmap_clock_keeps_hot_keys(void) {
+    struct chmap * map = chmap_cache_new(sizeof(int), sizeof(int), 100, CHMAP_EVICT_CLOCK);
+    const size_t array_size = map->array_size;
+
+    for (int key = 0; key < 100000; key++) {
+        chmap_put(map, &key, &key);
+
+        // Keys below 10 are used all the time, and should never be evicted once they're in.
+        for (int hot = 0; hot < 10 && hot <= key; hot++) {
+            TEST_ASSERT_EQUAL_INT(hot, *(int *)chmap_get(map, &hot));
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(100, map->used_size);
+    TEST_ASSERT_EQUAL_size_t(array_size, map->array_size);
+
+    chmap_free(map);
+}
+
+void chmap_clock_survives_resize_clear_and_clone(void) {
+    struct chmap * map = chmap_cache_new(sizeof(int), sizeof(int), 50, CHMAP_EVICT_CLOCK);
+
+    for (int key = 0; key < 50; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    chmap_reserve(map, 1000);
+
+    for (int key = 50; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+        TEST_ASSERT_EQUAL_INT(key, *(int *)chmap_get(map, &key));
+    }
+
+    TEST_ASSERT_EQUAL_size_t(50, map->used_size);
+
+    struct chmap * clone = chmap_clone(map);
+    struct chmap * lru = chmap_cache_new(sizeof(int), sizeof(int), 50, CHMAP_EVICT_LRU);
+
+    TEST_ASSERT_EQUAL_INT(-1, chmap_copy(lru, map));
+
+    chmap_clear(map);
+
+    for (int key = 0; key < 100; key++) {
+        chmap_put(map, &key, &key);
+        chmap_put(clone, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(50, map->used_size);
+    TEST_ASSERT_EQUAL_size_t(50, clone->used_size);
+
+    chmap_free(lru);
+    chmap_free(clone);
+    chmap_free(map);
+}
+
+void chmap_clock_bounded_by_bytes(void) {
+    struct chmap * map = chmap_cache_new_bytes(64, sizeof(int), 1 << 20, CHMAP_EVICT_CLOCK);
+    struct chmap * lru = chmap_cache_new_bytes(64, sizeof(int), 1 << 20, CHMAP_EVICT_LRU);
+    char item[64] = {0};
+    struct chmap_stats stats;
+
+    for (int key = 0; key < 100000; key++) {
+        chmap_put(map, &key, item);
+    }
+
+    chmap_stats(map, &stats);
+
+    TEST_ASSERT_TRUE(stats.translation_array_bytes + stats.backing_array_bytes + stats.bais_bytes
+                     + stats.lru_bytes <= 1 << 20);
+
+    // CLOCK keeps a byte per slot where LRU keeps two links, so it fits more items in the same bytes.
+    TEST_ASSERT_TRUE(map->lru->capacity > lru->lru->capacity);
+
+    chmap_free(lru);
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_clock_gives_second_chances);
+    RUN_TEST(chmap_clock_keeps_hot_keys);
+    RUN_TEST(chmap_clock_survives_resize_clear_and_clone);
+    RUN_TEST(chmap_clock_bounded_by_bytes);
+    return UNITY_END();
+}
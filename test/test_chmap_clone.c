@@ -0,0 +1,122 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+void chmap_clone_char(void) {
+    struct chmap * map = chmap_new(sizeof(char), sizeof(char));
+
+    char put = 'A';
+    char key = 'B';
+
+    chmap_put(map, &key, &put);
+
+    struct chmap * clone = chmap_clone(map);
+    const char * got = chmap_get(clone, &key);
+
+    TEST_ASSERT_NOT_NULL(got);
+    TEST_ASSERT_EQUAL_UINT8('A', *got);
+
+    chmap_free(clone);
+    chmap_free(map);
+}
+
+void chmap_clone_is_independent(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int key = 0; key < 100; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    struct chmap * clone = chmap_clone(map);
+
+    for (int key = 0; key < 50; key++) {
+        chmap_del(map, &key);
+    }
+
+    for (int key = 100; key < 200; key++) {
+        chmap_put(clone, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(50, map->used_size);
+    TEST_ASSERT_EQUAL_size_t(200, clone->used_size);
+
+    for (int key = 0; key < 200; key++) {
+        const int * got = chmap_get(clone, &key);
+
+        TEST_ASSERT_NOT_NULL(got);
+        TEST_ASSERT_EQUAL_INT(key, *got);
+    }
+
+    chmap_free(map);
+    chmap_free(clone);
+}
+
+void chmap_clone_large_item(void) {
+    struct chmap * map = chmap_new(500, sizeof(int));
+    char item[500];
+
+    for (int key = 0; key < 10; key++) {
+        memset(item, 'a' + key, sizeof(item));
+        chmap_put(map, &key, item);
+    }
+
+    struct chmap * clone = chmap_clone(map);
+    chmap_free(map);
+
+    for (int key = 0; key < 10; key++) {
+        const char * got = chmap_get(clone, &key);
+
+        memset(item, 'a' + key, sizeof(item));
+        TEST_ASSERT_EQUAL_MEMORY(item, got, sizeof(item));
+    }
+
+    chmap_free(clone);
+}
+
+void chmap_copy_reuses_and_resizes(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * snapshot = chmap_new(sizeof(int), sizeof(int));
+
+    int key = 1;
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_copy(snapshot, map));
+    TEST_ASSERT_EQUAL_INT(1, *(int *)chmap_get(snapshot, &key));
+
+    for (key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_copy(snapshot, map));
+    TEST_ASSERT_EQUAL_size_t(1000, snapshot->used_size);
+
+    for (key = 0; key < 1000; key++) {
+        TEST_ASSERT_EQUAL_INT(key, *(int *)chmap_get(snapshot, &key));
+    }
+
+    chmap_free(map);
+    chmap_free(snapshot);
+}
+
+void chmap_copy_rejects_other_sizes(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * other = chmap_new(sizeof(char), sizeof(int));
+
+    TEST_ASSERT_EQUAL_INT(-1, chmap_copy(other, map));
+
+    chmap_free(map);
+    chmap_free(other);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_clone_char);
+    RUN_TEST(chmap_clone_is_independent);
+    RUN_TEST(chmap_clone_large_item);
+    RUN_TEST(chmap_copy_reuses_and_resizes);
+    RUN_TEST(chmap_copy_rejects_other_sizes);
+    return UNITY_END();
+}
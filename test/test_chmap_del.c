@@ -157,6 +157,54 @@ void chmap_del_after_growing(void) {
     }
 }
 
+void chmap_del_interleaved_with_puts(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    int present[500] = {0};
+    unsigned int seed = 1;
+
+    for (int i = 0; i < 20000; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int key = (seed >> 8) % 500;
+
+        if ((seed >> 4) & 1) {
+            chmap_put(map, &key, &key);
+            present[key] = 1;
+        } else {
+            chmap_del(map, &key);
+            present[key] = 0;
+        }
+    }
+
+    for (int key = 0; key < 500; key++) {
+        const int * got = chmap_get(map, &key);
+
+        if (present[key]) {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_INT(key, *got);
+        } else {
+            TEST_ASSERT_NULL(got);
+        }
+    }
+}
+
+void chmap_del_missing_key(void) {
+    struct chmap * map = chmap_new(sizeof(char), sizeof(char));
+
+    for (char key = 'A'; key < 'L'; key = (char) key + 1) {
+        chmap_put(map, &key, &key);
+    }
+
+    const char missing = 'Z';
+
+    chmap_del(map, &missing);
+
+    TEST_ASSERT_EQUAL_size_t(11, map->used_size);
+
+    for (char key = 'A'; key < 'L'; key = (char) key + 1) {
+        TEST_ASSERT_NOT_NULL(chmap_get(map, &key));
+    }
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(chmap_del_one_char);
@@ -167,5 +215,7 @@ int main(void) {
     RUN_TEST(chmap_del_large_key);
     RUN_TEST(chmap_del_many_repeatedly);
     RUN_TEST(chmap_del_after_growing);
+    RUN_TEST(chmap_del_interleaved_with_puts);
+    RUN_TEST(chmap_del_missing_key);
     return UNITY_END();
 }
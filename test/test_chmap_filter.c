@@ -0,0 +1,167 @@
+#define CHMAP_STATS
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static int is_odd(const void * item, void * ctx) {
+    (void)ctx;
+
+    return *(const int *)item % 2;
+}
+
+void chmap_filter_never_hides_a_key(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    // Keys put before the filter existed count too, and the map grows many times after.
+    for (int key = 0; key < 100; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_filter_enable(map, 0));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_filter_enable(map, 0));
+
+    for (int key = 100; key < 100000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    const struct chmap_filter_counters * counters = chmap_get_filter_counters(map);
+
+    // Only gets count as lookups, not the probes puts make on the way.
+    TEST_ASSERT_EQUAL_size_t(0, counters->lookups);
+
+    for (int key = 0; key < 100000; key++) {
+        TEST_ASSERT_EQUAL_INT(key, *(int *)chmap_get(map, &key));
+    }
+
+    TEST_ASSERT_EQUAL_size_t(100000, counters->lookups);
+    TEST_ASSERT_TRUE(counters->rebuilds > 0);
+    TEST_ASSERT_EQUAL_size_t(0, counters->negatives);
+    TEST_ASSERT_EQUAL_size_t(0, counters->false_positives);
+
+    chmap_free(map);
+}
+
+void chmap_filter_answers_most_misses(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap_stats stats;
+
+    chmap_filter_enable(map, 0);
+
+    for (int key = 0; key < 100000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    for (int key = 100000; key < 200000; key++) {
+        TEST_ASSERT_NULL(chmap_get(map, &key));
+    }
+
+    const struct chmap_filter_counters * counters = chmap_get_filter_counters(map);
+
+    // Every miss is either rejected by the filter or let through by mistake.
+    TEST_ASSERT_EQUAL_size_t(100000, counters->lookups);
+    TEST_ASSERT_EQUAL_size_t(100000, counters->negatives + counters->false_positives);
+    TEST_ASSERT_TRUE(counters->false_positives < 100000 / 20);
+
+    chmap_stats(map, &stats);
+    TEST_ASSERT_TRUE(stats.filter_bytes > 0);
+
+    // More bits per key let fewer misses through.
+    struct chmap * wide = chmap_clone(map);
+
+    chmap_filter_disable(wide);
+    TEST_ASSERT_NULL(chmap_get_filter_counters(wide));
+    chmap_filter_enable(wide, 20);
+
+    for (int key = 100000; key < 200000; key++) {
+        TEST_ASSERT_NULL(chmap_get(wide, &key));
+    }
+
+    TEST_ASSERT_TRUE(chmap_get_filter_counters(wide)->false_positives < counters->false_positives);
+
+    chmap_free(wide);
+    chmap_free(map);
+}
+
+void chmap_filter_rebuilds_after_deletes(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    chmap_reserve(map, 10000);
+    chmap_filter_enable(map, 0);
+
+    for (int key = 0; key < 10000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    const struct chmap_filter_counters * counters = chmap_get_filter_counters(map);
+    const size_t rebuilds = counters->rebuilds;
+
+    // Deleting keys leaves their bits set, until enough of them pile up.
+    for (int key = 0; key < 8000; key++) {
+        chmap_del(map, &key);
+    }
+
+    TEST_ASSERT_TRUE(counters->rebuilds > rebuilds);
+
+    // Keys removed before the last rebuild are back to being rejected outright.
+    const size_t negatives = counters->negatives;
+
+    for (int key = 0; key < 1000; key++) {
+        TEST_ASSERT_NULL(chmap_get(map, &key));
+    }
+
+    TEST_ASSERT_TRUE(counters->negatives - negatives > 900);
+
+    chmap_retain(map, is_odd, NULL);
+
+    for (int key = 8000; key < 10000; key++) {
+        TEST_ASSERT_EQUAL(key % 2, chmap_get(map, &key) != NULL);
+    }
+
+    chmap_free(map);
+}
+
+void chmap_filter_follows_clear_clone_and_copy(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * dst = chmap_new(sizeof(int), sizeof(int));
+    int key;
+
+    chmap_filter_enable(map, 0);
+    chmap_filter_enable(dst, 0);
+
+    for (key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    struct chmap * clone = chmap_clone(map);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_copy(dst, map));
+    chmap_clear(map);
+
+    for (key = 0; key < 1000; key++) {
+        TEST_ASSERT_NULL(chmap_get(map, &key));
+        TEST_ASSERT_EQUAL_INT(key, *(int *)chmap_get(clone, &key));
+        TEST_ASSERT_EQUAL_INT(key, *(int *)chmap_get(dst, &key));
+    }
+
+    TEST_ASSERT_EQUAL_size_t(1000, chmap_get_filter_counters(map)->negatives);
+
+    key = 5;
+    chmap_put(map, &key, &key);
+    TEST_ASSERT_EQUAL_INT(5, *(int *)chmap_get(map, &key));
+
+    chmap_free(clone);
+    chmap_free(dst);
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_filter_never_hides_a_key);
+    RUN_TEST(chmap_filter_answers_most_misses);
+    RUN_TEST(chmap_filter_rebuilds_after_deletes);
+    RUN_TEST(chmap_filter_follows_clear_clone_and_copy);
+    return UNITY_END();
+}
@@ -0,0 +1,129 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+#include <stdint.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+void chmap_freeze_char(void) {
+    struct chmap * map = chmap_new(sizeof(char), sizeof(char));
+
+    char put = 'A';
+    char key = 'B';
+
+    chmap_put(map, &key, &put);
+
+    struct chmap_frozen * frozen = chmap_freeze(map);
+    const char * got = chmap_frozen_get(frozen, &key);
+
+    TEST_ASSERT_NOT_NULL(got);
+    TEST_ASSERT_EQUAL_UINT8('A', *got);
+
+    chmap_frozen_free(frozen);
+    chmap_free(map);
+}
+
+void chmap_freeze_empty(void) {
+    struct chmap * map = chmap_new(sizeof(char), sizeof(char));
+    struct chmap_frozen * frozen = chmap_freeze(map);
+
+    char key = 'B';
+
+    TEST_ASSERT_NOT_NULL(frozen);
+    TEST_ASSERT_NULL(chmap_frozen_get(frozen, &key));
+
+    chmap_frozen_free(frozen);
+    chmap_free(map);
+}
+
+void chmap_freeze_many_outlives_map(void) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(uint32_t));
+
+    for (uint32_t key = 0; key < 50000; key++) {
+        uint64_t val = (uint64_t)key * 7;
+
+        chmap_put(map, &key, &val);
+    }
+
+    struct chmap_frozen * frozen = chmap_freeze(map);
+    chmap_free(map);
+
+    TEST_ASSERT_NOT_NULL(frozen);
+    TEST_ASSERT_EQUAL_size_t(50000, frozen->size);
+
+    for (uint32_t key = 0; key < 50000; key++) {
+        const uint64_t * got = chmap_frozen_get(frozen, &key);
+
+        TEST_ASSERT_NOT_NULL(got);
+        TEST_ASSERT_EQUAL_UINT64((uint64_t)key * 7, *got);
+    }
+
+    for (uint32_t key = 50000; key < 60000; key++) {
+        TEST_ASSERT_NULL(chmap_frozen_get(frozen, &key));
+    }
+
+    chmap_frozen_free(frozen);
+}
+
+void chmap_freeze_skips_deleted(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int key = 0; key < 100; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    for (int key = 0; key < 100; key += 3) {
+        chmap_del(map, &key);
+    }
+
+    struct chmap_frozen * frozen = chmap_freeze(map);
+
+    TEST_ASSERT_EQUAL_size_t(map->used_size, frozen->size);
+
+    for (int key = 0; key < 100; key++) {
+        const int * got = chmap_frozen_get(frozen, &key);
+
+        if (key % 3 == 0) {
+            TEST_ASSERT_NULL(got);
+        } else {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_INT(key, *got);
+        }
+    }
+
+    chmap_frozen_free(frozen);
+    chmap_free(map);
+}
+
+void chmap_freeze_large_item(void) {
+    struct chmap * map = chmap_new(13, sizeof(int));
+    char item[13] = "twelve chars";
+
+    for (int key = 0; key < 10; key++) {
+        item[0] = (char)('a' + key);
+        chmap_put(map, &key, item);
+    }
+
+    struct chmap_frozen * frozen = chmap_freeze(map);
+
+    for (int key = 0; key < 10; key++) {
+        const char * got = chmap_frozen_get(frozen, &key);
+
+        TEST_ASSERT_EQUAL_CHAR('a' + key, got[0]);
+        TEST_ASSERT_EQUAL_STRING("welve chars", got + 1);
+    }
+
+    chmap_frozen_free(frozen);
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_freeze_char);
+    RUN_TEST(chmap_freeze_empty);
+    RUN_TEST(chmap_freeze_many_outlives_map);
+    RUN_TEST(chmap_freeze_skips_deleted);
+    RUN_TEST(chmap_freeze_large_item);
+    return UNITY_END();
+}
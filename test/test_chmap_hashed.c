@@ -0,0 +1,95 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+void chmap_hashed_matches_keyed(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int key = 0; key < 100; key++) {
+        chmap_put_hashed(map, chmap_hash(map, &key), &key);
+    }
+
+    for (int key = 0; key < 100; key++) {
+        const int * got = chmap_get(map, &key);
+
+        TEST_ASSERT_NOT_NULL(got);
+        TEST_ASSERT_EQUAL_INT(key, *got);
+        TEST_ASSERT_EQUAL_PTR(got, chmap_get_hashed(map, chmap_hash(map, &key)));
+    }
+
+    for (int key = 0; key < 100; key += 2) {
+        chmap_del_hashed(map, chmap_hash(map, &key));
+    }
+
+    for (int key = 0; key < 100; key++) {
+        if (key % 2 == 0) {
+            TEST_ASSERT_NULL(chmap_get(map, &key));
+        } else {
+            TEST_ASSERT_NOT_NULL(chmap_get(map, &key));
+        }
+    }
+
+    chmap_free(map);
+}
+
+void chmap_hashed_put_reports_overwrite(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    int key = 5;
+    const uint64_t hash = chmap_hash(map, &key);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_put_hashed(map, hash, &key));
+    TEST_ASSERT_EQUAL_INT(1, chmap_put_hashed(map, hash, &key));
+
+    chmap_free(map);
+}
+
+void chmap_hashed_across_maps(void) {
+    struct chmap * maps[4];
+
+    for (int i = 0; i < 4; i++) {
+        maps[i] = chmap_new(sizeof(int), sizeof(int));
+    }
+
+    int key = 1234;
+    const uint64_t hash = chmap_hash(maps[0], &key);
+
+    for (int i = 0; i < 4; i++) {
+        chmap_put_hashed(maps[i], hash, &i);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_INT(i, *(int *)chmap_get(maps[i], &key));
+        chmap_free(maps[i]);
+    }
+}
+
+void chmap_hashed_upsert(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    int key = 9;
+    int inserted;
+    const uint64_t hash = chmap_hash(map, &key);
+
+    *(int *)chmap_upsert_hashed(map, hash, &inserted) += 3;
+    TEST_ASSERT_EQUAL_INT(1, inserted);
+
+    *(int *)chmap_upsert_hashed(map, hash, &inserted) += 3;
+    TEST_ASSERT_EQUAL_INT(0, inserted);
+
+    TEST_ASSERT_EQUAL_INT(6, *(int *)chmap_get(map, &key));
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_hashed_matches_keyed);
+    RUN_TEST(chmap_hashed_put_reports_overwrite);
+    RUN_TEST(chmap_hashed_across_maps);
+    RUN_TEST(chmap_hashed_upsert);
+    return UNITY_END();
+}
@@ -0,0 +1,140 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static int keep_odd(const void * item, void * ctx) {
+    (void)ctx;
+    return *(const uint32_t *)item % 2 == 1;
+}
+
+void chmap_inline_has_no_backing_array(void) {
+    struct chmap * map = chmap_new_flags(sizeof(uint64_t), sizeof(int), CHMAP_INLINE_ITEMS);
+    struct chmap_stats stats;
+
+    for (int key = 0; key < 1000; key++) {
+        uint64_t val = (uint64_t)key << 32;
+        chmap_put(map, &key, &val);
+    }
+
+    TEST_ASSERT_NULL(map->backing_array);
+    TEST_ASSERT_NULL(map->bais);
+
+    chmap_stats(map, &stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.backing_array_bytes);
+    TEST_ASSERT_EQUAL_size_t(0, stats.bais_bytes);
+
+    chmap_free(map);
+}
+
+void chmap_inline_ignored_for_big_items(void) {
+    struct chmap * map = chmap_new_flags(CHMAP_INLINE_MAX_SIZE + 1, sizeof(int), CHMAP_INLINE_ITEMS);
+
+    TEST_ASSERT_EQUAL_UINT(0, map->flags & CHMAP_INLINE_ITEMS);
+    TEST_ASSERT_NOT_NULL(map->backing_array);
+
+    chmap_free(map);
+}
+
+void chmap_inline_matches_backed_map(void) {
+    struct chmap * inline_map = chmap_new_flags(sizeof(uint32_t), sizeof(uint32_t), CHMAP_INLINE_ITEMS);
+    struct chmap * map = chmap_new(sizeof(uint32_t), sizeof(uint32_t));
+    uint64_t state = 88172645463325252ULL;
+
+    for (uint32_t i = 0; i < 100000; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        const uint32_t key = (uint32_t)(state % 5000);
+        uint32_t taken_inline, taken;
+
+        switch (state % 5) {
+            case 0:
+                chmap_del(map, &key);
+                chmap_del(inline_map, &key);
+                break;
+            case 1:
+                TEST_ASSERT_EQUAL_INT(chmap_take(map, &key, &taken), chmap_take(inline_map, &key, &taken_inline));
+                break;
+            case 2:
+                *(uint32_t *)chmap_upsert(map, &key, NULL) += i;
+                *(uint32_t *)chmap_upsert(inline_map, &key, NULL) += i;
+                break;
+            default:
+                chmap_put(map, &key, &i);
+                chmap_put(inline_map, &key, &i);
+                break;
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(map->used_size, inline_map->used_size);
+
+    for (uint32_t key = 0; key < 5000; key++) {
+        const uint32_t * expected = chmap_get(map, &key);
+        const uint32_t * got = chmap_get(inline_map, &key);
+
+        if (expected == NULL) {
+            TEST_ASSERT_NULL(got);
+        } else {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_UINT32(*expected, *got);
+        }
+    }
+
+    chmap_free(map);
+    chmap_free(inline_map);
+}
+
+void chmap_inline_bulk_operations(void) {
+    struct chmap * map = chmap_new_flags(sizeof(uint32_t), sizeof(uint32_t), CHMAP_INLINE_ITEMS);
+
+    for (uint32_t key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    struct chmap * clone = chmap_clone(map);
+    struct chmap * copy = chmap_new_flags(sizeof(uint32_t), sizeof(uint32_t), CHMAP_INLINE_ITEMS);
+    struct chmap * backed = chmap_new(sizeof(uint32_t), sizeof(uint32_t));
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_copy(copy, map));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_copy(backed, map));
+    TEST_ASSERT_EQUAL_INT(0, chmap_merge(backed, map, CHMAP_MERGE_OVERWRITE, NULL, NULL));
+
+    TEST_ASSERT_EQUAL_size_t(500, chmap_retain(map, keep_odd, NULL));
+
+    struct chmap_frozen * frozen = chmap_freeze(clone);
+
+    for (uint32_t key = 0; key < 1000; key++) {
+        TEST_ASSERT_EQUAL_UINT32(key, *(uint32_t *)chmap_get(clone, &key));
+        TEST_ASSERT_EQUAL_UINT32(key, *(uint32_t *)chmap_get(copy, &key));
+        TEST_ASSERT_EQUAL_UINT32(key, *(uint32_t *)chmap_get(backed, &key));
+        TEST_ASSERT_EQUAL_UINT32(key, *(uint32_t *)chmap_frozen_get(frozen, &key));
+
+        if (key % 2 == 1) {
+            TEST_ASSERT_EQUAL_UINT32(key, *(uint32_t *)chmap_get(map, &key));
+        } else {
+            TEST_ASSERT_NULL(chmap_get(map, &key));
+        }
+    }
+
+    chmap_clear(clone);
+    TEST_ASSERT_EQUAL_size_t(0, clone->used_size);
+
+    chmap_frozen_free(frozen);
+    chmap_free(backed);
+    chmap_free(copy);
+    chmap_free(clone);
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_inline_has_no_backing_array);
+    RUN_TEST(chmap_inline_ignored_for_big_items);
+    RUN_TEST(chmap_inline_matches_backed_map);
+    RUN_TEST(chmap_inline_bulk_operations);
+    return UNITY_END();
+}
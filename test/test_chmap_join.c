@@ -0,0 +1,120 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+#define BUILD_ROWS 3000
+#define PROBE_ROWS 2000
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static int build_keys[BUILD_ROWS];
+static int probe_keys[PROBE_ROWS];
+
+/**
+ * Build keys are [0, 1000), each three times. Probe keys are [500, 2500), so half of them match.
+ */
+static void fill_keys(void) {
+    for (int i = 0; i < BUILD_ROWS; i++) {
+        build_keys[i] = i % 1000;
+    }
+
+    for (int i = 0; i < PROBE_ROWS; i++) {
+        probe_keys[i] = 500 + i;
+    }
+}
+
+/**
+ * Probes the whole probe side `capacity` pairs at a time, and checks that every pair matches and that
+ * every match is found exactly once.
+ */
+static void check_join(struct chmap_join * join, const size_t capacity) {
+    size_t build_rows[64];
+    size_t probe_rows[64];
+    unsigned char seen[BUILD_ROWS] = {0};
+    struct chmap_join_cursor cursor = {0};
+    size_t total = 0;
+
+    while (cursor.row < PROBE_ROWS) {
+        const size_t written = chmap_join_probe(join, probe_keys, PROBE_ROWS, &cursor, build_rows, probe_rows,
+                                                capacity);
+
+        TEST_ASSERT_TRUE(written <= capacity);
+
+        for (size_t i = 0; i < written; i++) {
+            TEST_ASSERT_EQUAL_INT(build_keys[build_rows[i]], probe_keys[probe_rows[i]]);
+            TEST_ASSERT_EQUAL_UINT8(0, seen[build_rows[i]]);
+            seen[build_rows[i]] = 1;
+        }
+
+        total += written;
+    }
+
+    // Probe keys [500, 1000) each match three build rows.
+    TEST_ASSERT_EQUAL_size_t(1500, total);
+}
+
+void chmap_join_single_partition(void) {
+    fill_keys();
+
+    struct chmap_join * join = chmap_join_build(build_keys, BUILD_ROWS, sizeof(int), 1);
+
+    TEST_ASSERT_EQUAL_size_t(1, join->partition_count);
+    TEST_ASSERT_EQUAL_size_t(BUILD_ROWS, join->partitions[0]->used_size);
+    check_join(join, 64);
+
+    chmap_join_free(join);
+}
+
+void chmap_join_partitioned(void) {
+    fill_keys();
+
+    struct chmap_join * join = chmap_join_build(build_keys, BUILD_ROWS, sizeof(int), 5);
+    size_t total = 0;
+
+    TEST_ASSERT_EQUAL_size_t(8, join->partition_count);
+
+    for (size_t p = 0; p < join->partition_count; p++) {
+        total += join->partitions[p]->used_size;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(BUILD_ROWS, total);
+    check_join(join, 64);
+
+    chmap_join_free(join);
+}
+
+void chmap_join_resumes_within_a_key(void) {
+    fill_keys();
+
+    // Buffers smaller than a key's matches have to stop partway through them.
+    struct chmap_join * join = chmap_join_build(build_keys, BUILD_ROWS, sizeof(int), 0);
+
+    check_join(join, 1);
+    check_join(join, 2);
+
+    chmap_join_free(join);
+}
+
+void chmap_join_no_matches(void) {
+    fill_keys();
+
+    struct chmap_join * join = chmap_join_build(build_keys, 0, sizeof(int), 0);
+    struct chmap_join_cursor cursor = {0};
+    size_t build_rows[4];
+    size_t probe_rows[4];
+
+    TEST_ASSERT_EQUAL_size_t(0, chmap_join_probe(join, probe_keys, PROBE_ROWS, &cursor, build_rows, probe_rows, 4));
+    TEST_ASSERT_EQUAL_size_t(PROBE_ROWS, cursor.row);
+
+    chmap_join_free(join);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_join_single_partition);
+    RUN_TEST(chmap_join_partitioned);
+    RUN_TEST(chmap_join_resumes_within_a_key);
+    RUN_TEST(chmap_join_no_matches);
+    return UNITY_END();
+}
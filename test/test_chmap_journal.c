@@ -0,0 +1,202 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+#include <stdio.h>
+
+#define JOURNAL_PATH "test_chmap_journal.tmp"
+
+void setUp(void) {
+    remove(JOURNAL_PATH);
+}
+
+void tearDown(void) {
+    remove(JOURNAL_PATH);
+}
+
+
+static long journal_length(void) {
+    FILE * journal = fopen(JOURNAL_PATH, "rb");
+    fseek(journal, 0, SEEK_END);
+    long length = ftell(journal);
+    fclose(journal);
+
+    return length;
+}
+
+void chmap_journal_recovers_puts(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    TEST_ASSERT_EQUAL_INT(0, chmap_journal_open(map, JOURNAL_PATH));
+
+    for (int key = 0; key < 100; key++) {
+        int val = key * 3;
+
+        chmap_put(map, &key, &val);
+    }
+
+    chmap_free(map);
+
+    struct chmap * recovered = chmap_new(sizeof(int), sizeof(int));
+    TEST_ASSERT_EQUAL_INT(0, chmap_journal_open(recovered, JOURNAL_PATH));
+
+    TEST_ASSERT_EQUAL_size_t(100, recovered->used_size);
+
+    for (int key = 0; key < 100; key++) {
+        const int * got = chmap_get(recovered, &key);
+
+        TEST_ASSERT_NOT_NULL(got);
+        TEST_ASSERT_EQUAL_INT(key * 3, *got);
+    }
+
+    chmap_free(recovered);
+}
+
+void chmap_journal_recovers_dels_and_overwrites(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    chmap_journal_open(map, JOURNAL_PATH);
+
+    for (int key = 0; key < 50; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    for (int key = 0; key < 50; key += 2) {
+        chmap_del(map, &key);
+    }
+
+    int key = 1;
+    int val = -1;
+    chmap_put(map, &key, &val);
+
+    chmap_free(map);
+
+    struct chmap * recovered = chmap_new(sizeof(int), sizeof(int));
+    chmap_journal_open(recovered, JOURNAL_PATH);
+
+    TEST_ASSERT_EQUAL_size_t(25, recovered->used_size);
+
+    for (key = 0; key < 50; key++) {
+        const int * got = chmap_get(recovered, &key);
+
+        if (key % 2 == 0) {
+            TEST_ASSERT_NULL(got);
+        } else {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_INT(key == 1 ? -1 : key, *got);
+        }
+    }
+
+    chmap_free(recovered);
+}
+
+void chmap_journal_compact_shrinks(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    chmap_journal_open(map, JOURNAL_PATH);
+
+    int key = 7;
+
+    for (int val = 0; val < 30; val++) {
+        chmap_put(map, &key, &val);
+    }
+
+    chmap_journal_close(map);
+    const long before = journal_length();
+    chmap_journal_open(map, JOURNAL_PATH);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_journal_compact(map));
+    chmap_free(map);
+
+    TEST_ASSERT_LESS_THAN(before, journal_length());
+
+    struct chmap * recovered = chmap_new(sizeof(int), sizeof(int));
+    chmap_journal_open(recovered, JOURNAL_PATH);
+
+    TEST_ASSERT_EQUAL_INT(29, *(int *)chmap_get(recovered, &key));
+
+    chmap_free(recovered);
+}
+
+void chmap_journal_ignores_torn_record(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    chmap_journal_open(map, JOURNAL_PATH);
+
+    int key = 1;
+    chmap_put(map, &key, &key);
+    chmap_free(map);
+
+    // Simulate a writer that died halfway through appending a put.
+    FILE * journal = fopen(JOURNAL_PATH, "ab");
+    fputc('P', journal);
+    fputc(0x42, journal);
+    fclose(journal);
+
+    struct chmap * recovered = chmap_new(sizeof(int), sizeof(int));
+    TEST_ASSERT_EQUAL_INT(0, chmap_journal_open(recovered, JOURNAL_PATH));
+    TEST_ASSERT_EQUAL_size_t(1, recovered->used_size);
+
+    key = 2;
+    chmap_put(recovered, &key, &key);
+    chmap_free(recovered);
+
+    struct chmap * again = chmap_new(sizeof(int), sizeof(int));
+    chmap_journal_open(again, JOURNAL_PATH);
+
+    TEST_ASSERT_EQUAL_size_t(2, again->used_size);
+    TEST_ASSERT_EQUAL_INT(2, *(int *)chmap_get(again, &key));
+
+    chmap_free(again);
+}
+
+void chmap_journal_rejects_other_sizes(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    chmap_journal_open(map, JOURNAL_PATH);
+    chmap_free(map);
+
+    struct chmap * other = chmap_new(sizeof(double), sizeof(int));
+
+    TEST_ASSERT_EQUAL_INT(-1, chmap_journal_open(other, JOURNAL_PATH));
+    TEST_ASSERT_NULL(other->journal);
+
+    chmap_free(other);
+}
+
+void chmap_journal_rejects_expiry(void) {
+    struct chmap * expiring = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * journaled = chmap_new(sizeof(int), sizeof(int));
+
+    // Journals don't record expiries, so the two can't be used together, whichever comes first.
+    chmap_ttl_enable(expiring, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL_INT(-1, chmap_journal_open(expiring, JOURNAL_PATH));
+    TEST_ASSERT_NULL(expiring->journal);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_journal_open(journaled, JOURNAL_PATH));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_ttl_enable(journaled, 0, NULL, NULL));
+    TEST_ASSERT_NULL(journaled->ttl);
+
+    chmap_free(journaled);
+    chmap_free(expiring);
+}
+
+void chmap_journal_compacts_automatically(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    chmap_journal_open(map, JOURNAL_PATH);
+
+    int key = 3;
+
+    for (int val = 0; val < 1000; val++) {
+        chmap_put(map, &key, &val);
+    }
+
+    TEST_ASSERT_LESS_THAN(1000, map->journal_records);
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_journal_recovers_puts);
+    RUN_TEST(chmap_journal_recovers_dels_and_overwrites);
+    RUN_TEST(chmap_journal_compact_shrinks);
+    RUN_TEST(chmap_journal_ignores_torn_record);
+    RUN_TEST(chmap_journal_rejects_other_sizes);
+    RUN_TEST(chmap_journal_rejects_expiry);
+    RUN_TEST(chmap_journal_compacts_automatically);
+    return UNITY_END();
+}
@@ -0,0 +1,201 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static int has_key(struct chmap * map, int key) {
+    // Gets count as uses, so look without touching the recency list.
+    return find_hash(map, chmap_hash(map, &key)) != map->array_size;
+}
+
+void chmap_lru_evicts_least_recently_used(void) {
+    struct chmap * map = chmap_lru_new(sizeof(int), sizeof(int), 3);
+
+    for (int key = 0; key < 3; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    // 0 is now the most recently used, so 1 goes first.
+    int key = 0;
+    TEST_ASSERT_EQUAL_INT(0, *(int *)chmap_get(map, &key));
+
+    key = 3;
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_EQUAL_size_t(3, map->used_size);
+    TEST_ASSERT_TRUE(has_key(map, 0));
+    TEST_ASSERT_FALSE(has_key(map, 1));
+    TEST_ASSERT_TRUE(has_key(map, 2));
+    TEST_ASSERT_TRUE(has_key(map, 3));
+
+    // Overwriting an item counts as using it too.
+    key = 2;
+    chmap_put(map, &key, &key);
+    key = 4;
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_FALSE(has_key(map, 0));
+    TEST_ASSERT_TRUE(has_key(map, 2));
+
+    chmap_free(map);
+}
+
+void chmap_lru_counts(void) {
+    struct chmap * map = chmap_lru_new(sizeof(int), sizeof(int), 100);
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    for (int key = 0; key < 1000; key++) {
+        void * item = chmap_get(map, &key);
+
+        TEST_ASSERT_EQUAL(key >= 900, item != NULL);
+    }
+
+    const struct chmap_lru_counters * counters = chmap_get_lru_counters(map);
+
+    TEST_ASSERT_EQUAL_size_t(100, counters->hits);
+    TEST_ASSERT_EQUAL_size_t(900, counters->misses);
+    TEST_ASSERT_EQUAL_size_t(900, counters->evictions);
+    TEST_ASSERT_EQUAL_size_t(100, map->used_size);
+
+    struct chmap * plain = chmap_new(sizeof(int), sizeof(int));
+    TEST_ASSERT_NULL(chmap_get_lru_counters(plain));
+
+    chmap_free(plain);
+    chmap_free(map);
+}
+
+void chmap_lru_never_grows_once_full(void) {
+    struct chmap * map = chmap_lru_new(sizeof(int), sizeof(int), 1000);
+    const size_t array_size = map->array_size;
+    const size_t grow_count = map->grow_count;
+
+    for (int key = 0; key < 100000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(array_size, map->array_size);
+    TEST_ASSERT_EQUAL_size_t(grow_count, map->grow_count);
+
+    for (int key = 99000; key < 100000; key++) {
+        TEST_ASSERT_EQUAL_INT(key, *(int *)chmap_get(map, &key));
+    }
+
+    chmap_free(map);
+}
+
+void chmap_lru_del_and_take_unlink(void) {
+    struct chmap * map = chmap_lru_new(sizeof(int), sizeof(int), 4);
+
+    for (int key = 0; key < 4; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    int key = 0;
+    chmap_del(map, &key);
+    key = 3;
+    TEST_ASSERT_EQUAL_INT(1, chmap_take(map, &key, NULL));
+
+    for (key = 10; key < 13; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    // The map only filled back up with the last new key, which evicted the oldest left.
+    TEST_ASSERT_EQUAL_size_t(1, chmap_get_lru_counters(map)->evictions);
+    TEST_ASSERT_FALSE(has_key(map, 1));
+    TEST_ASSERT_TRUE(has_key(map, 2));
+
+    chmap_clear(map);
+
+    for (key = 0; key < 6; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_FALSE(has_key(map, 1));
+    TEST_ASSERT_TRUE(has_key(map, 2));
+    TEST_ASSERT_TRUE(has_key(map, 5));
+
+    chmap_free(map);
+}
+
+void chmap_lru_keeps_order_through_resize(void) {
+    struct chmap * map = chmap_lru_new(sizeof(int), sizeof(int), 1000);
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    // Growing moves every entry, but recency has to survive it.
+    chmap_reserve(map, 10000);
+
+    int key = 1000;
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_FALSE(has_key(map, 0));
+    TEST_ASSERT_TRUE(has_key(map, 1));
+
+    chmap_free(map);
+}
+
+void chmap_lru_clone_is_independent(void) {
+    struct chmap * map = chmap_lru_new(sizeof(int), sizeof(int), 2);
+    int key = 0;
+
+    chmap_put(map, &key, &key);
+    key = 1;
+    chmap_put(map, &key, &key);
+
+    struct chmap * clone = chmap_clone(map);
+
+    key = 2;
+    chmap_put(clone, &key, &key);
+
+    TEST_ASSERT_TRUE(has_key(map, 0));
+    TEST_ASSERT_FALSE(has_key(clone, 0));
+
+    struct chmap * other = chmap_lru_new(sizeof(int), sizeof(int), 3);
+    TEST_ASSERT_EQUAL_INT(-1, chmap_copy(other, map));
+    TEST_ASSERT_EQUAL_INT(0, chmap_copy(clone, map));
+    TEST_ASSERT_TRUE(has_key(clone, 0));
+
+    chmap_free(other);
+    chmap_free(clone);
+    chmap_free(map);
+}
+
+void chmap_lru_bounded_by_bytes(void) {
+    struct chmap * map = chmap_lru_new_bytes(64, sizeof(int), 1 << 20);
+    char item[64] = {0};
+    struct chmap_stats stats;
+
+    for (int key = 0; key < 100000; key++) {
+        chmap_put(map, &key, item);
+    }
+
+    chmap_stats(map, &stats);
+
+    TEST_ASSERT_TRUE(stats.translation_array_bytes + stats.backing_array_bytes + stats.bais_bytes
+                     + stats.lru_bytes <= 1 << 20);
+    // Each slot takes 128 bytes here, and half the slots are kept free.
+    TEST_ASSERT_TRUE(map->used_size > 4000);
+
+    TEST_ASSERT_NULL(chmap_lru_new_bytes(64, sizeof(int), 100));
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_lru_evicts_least_recently_used);
+    RUN_TEST(chmap_lru_counts);
+    RUN_TEST(chmap_lru_never_grows_once_full);
+    RUN_TEST(chmap_lru_del_and_take_unlink);
+    RUN_TEST(chmap_lru_keeps_order_through_resize);
+    RUN_TEST(chmap_lru_clone_is_independent);
+    RUN_TEST(chmap_lru_bounded_by_bytes);
+    return UNITY_END();
+}
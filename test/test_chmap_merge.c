@@ -0,0 +1,171 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static void add_ints(void * dst_item, const void * src_item, void * ctx) {
+    *(int *)dst_item += *(const int *)src_item;
+    (*(int *)ctx)++;
+}
+
+/**
+ * Fills `dst` with keys [0, 100) mapped to 1, and `src` with keys [50, 150) mapped to 10.
+ */
+static void fill_overlapping(struct chmap * dst, struct chmap * src) {
+    const int one = 1;
+    const int ten = 10;
+
+    for (int key = 0; key < 100; key++) {
+        chmap_put(dst, &key, &one);
+    }
+
+    for (int key = 50; key < 150; key++) {
+        chmap_put(src, &key, &ten);
+    }
+}
+
+void chmap_merge_overwrite(void) {
+    struct chmap * dst = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * src = chmap_new(sizeof(int), sizeof(int));
+    fill_overlapping(dst, src);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_merge(dst, src, CHMAP_MERGE_OVERWRITE, NULL, NULL));
+    TEST_ASSERT_EQUAL_size_t(150, dst->used_size);
+
+    for (int key = 0; key < 150; key++) {
+        TEST_ASSERT_EQUAL_INT(key < 50 ? 1 : 10, *(int *)chmap_get(dst, &key));
+    }
+
+    chmap_free(dst);
+    chmap_free(src);
+}
+
+void chmap_merge_keep(void) {
+    struct chmap * dst = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * src = chmap_new(sizeof(int), sizeof(int));
+    fill_overlapping(dst, src);
+
+    chmap_merge(dst, src, CHMAP_MERGE_KEEP, NULL, NULL);
+    TEST_ASSERT_EQUAL_size_t(150, dst->used_size);
+
+    for (int key = 0; key < 150; key++) {
+        TEST_ASSERT_EQUAL_INT(key < 100 ? 1 : 10, *(int *)chmap_get(dst, &key));
+    }
+
+    chmap_free(dst);
+    chmap_free(src);
+}
+
+void chmap_merge_combine(void) {
+    struct chmap * dst = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * src = chmap_new(sizeof(int), sizeof(int));
+    fill_overlapping(dst, src);
+
+    int calls = 0;
+
+    chmap_merge(dst, src, CHMAP_MERGE_COMBINE, add_ints, &calls);
+
+    TEST_ASSERT_EQUAL_INT(50, calls);
+
+    for (int key = 0; key < 150; key++) {
+        const int expected = key < 50 ? 1 : key < 100 ? 11 : 10;
+
+        TEST_ASSERT_EQUAL_INT(expected, *(int *)chmap_get(dst, &key));
+    }
+
+    chmap_free(dst);
+    chmap_free(src);
+}
+
+void chmap_merge_leaves_src_alone(void) {
+    struct chmap * dst = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * src = chmap_new(sizeof(int), sizeof(int));
+    fill_overlapping(dst, src);
+
+    chmap_merge(dst, src, CHMAP_MERGE_OVERWRITE, NULL, NULL);
+
+    TEST_ASSERT_EQUAL_size_t(100, src->used_size);
+
+    for (int key = 50; key < 150; key++) {
+        TEST_ASSERT_EQUAL_INT(10, *(int *)chmap_get(src, &key));
+    }
+
+    chmap_free(dst);
+    chmap_free(src);
+}
+
+void chmap_merge_rejects_bad_args(void) {
+    struct chmap * dst = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * src = chmap_new(sizeof(char), sizeof(int));
+
+    TEST_ASSERT_EQUAL_INT(-1, chmap_merge(dst, src, CHMAP_MERGE_OVERWRITE, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_merge(dst, dst, CHMAP_MERGE_COMBINE, NULL, NULL));
+
+    chmap_free(dst);
+    chmap_free(src);
+}
+
+void chmap_reserve_avoids_growth(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    chmap_reserve(map, 1000);
+
+    const size_t reserved = map->array_size;
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(reserved, map->array_size);
+
+    for (int key = 0; key < 1000; key++) {
+        TEST_ASSERT_EQUAL_INT(key, *(int *)chmap_get(map, &key));
+    }
+
+    chmap_free(map);
+}
+
+void chmap_merge_into_bounded_cache(void) {
+    struct chmap * dst = chmap_lru_new(sizeof(int), sizeof(int), 50);
+    struct chmap * src = chmap_new(sizeof(int), sizeof(int));
+    fill_overlapping(dst, src);
+
+    const size_t array_size = dst->array_size;
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_merge(dst, src, CHMAP_MERGE_OVERWRITE, NULL, NULL));
+
+    // dst evicts to make room for src, instead of growing past its capacity.
+    TEST_ASSERT_EQUAL_size_t(array_size, dst->array_size);
+    TEST_ASSERT_EQUAL_size_t(50, dst->used_size);
+
+    // src is merged in slot order, so which keys survive is up to their hashes, but none are stale.
+    size_t found = 0;
+
+    for (int key = 0; key < 150; key++) {
+        const int * item = chmap_get(dst, &key);
+
+        if (item != NULL) {
+            TEST_ASSERT_EQUAL_INT(key < 50 ? 1 : 10, *item);
+            found++;
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(50, found);
+
+    chmap_free(dst);
+    chmap_free(src);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_merge_overwrite);
+    RUN_TEST(chmap_merge_keep);
+    RUN_TEST(chmap_merge_combine);
+    RUN_TEST(chmap_merge_leaves_src_alone);
+    RUN_TEST(chmap_merge_rejects_bad_args);
+    RUN_TEST(chmap_reserve_avoids_growth);
+    RUN_TEST(chmap_merge_into_bounded_cache);
+    return UNITY_END();
+}
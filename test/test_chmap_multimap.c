@@ -0,0 +1,149 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+struct collected {
+    int items[256];
+    size_t count;
+};
+
+static void collect(void * item, void * ctx) {
+    struct collected * collected = ctx;
+
+    collected->items[collected->count++] = *(int *)item;
+}
+
+static int sum_of(const struct collected * collected) {
+    int sum = 0;
+
+    for (size_t i = 0; i < collected->count; i++) {
+        sum += collected->items[i];
+    }
+
+    return sum;
+}
+
+void chmap_multimap_keeps_duplicates(void) {
+    struct chmap * map = chmap_new_flags(sizeof(int), sizeof(int), CHMAP_MULTIMAP);
+
+    // Key k gets k + 1 items: k * 1000, k * 1000 + 1, ...
+    for (int key = 0; key < 50; key++) {
+        for (int i = 0; i <= key; i++) {
+            int val = key * 1000 + i;
+
+            TEST_ASSERT_EQUAL_INT(0, chmap_put(map, &key, &val));
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(50 * 51 / 2, map->used_size);
+
+    for (int key = 0; key < 50; key++) {
+        struct collected collected = {{0}, 0};
+
+        TEST_ASSERT_EQUAL_size_t(key + 1, chmap_get_all(map, &key, collect, &collected));
+        TEST_ASSERT_EQUAL_size_t(key + 1, collected.count);
+        TEST_ASSERT_EQUAL_size_t(key + 1, chmap_count(map, &key));
+        TEST_ASSERT_EQUAL_INT((key + 1) * key * 1000 + key * (key + 1) / 2, sum_of(&collected));
+    }
+
+    int missing = 50;
+    TEST_ASSERT_EQUAL_size_t(0, chmap_count(map, &missing));
+
+    chmap_free(map);
+}
+
+void chmap_multimap_del_removes_all(void) {
+    struct chmap * map = chmap_new_flags(sizeof(int), sizeof(int), CHMAP_MULTIMAP);
+
+    for (int key = 0; key < 100; key++) {
+        for (int i = 0; i < 5; i++) {
+            chmap_put(map, &key, &i);
+        }
+    }
+
+    for (int key = 0; key < 100; key += 2) {
+        chmap_del(map, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(250, map->used_size);
+
+    for (int key = 0; key < 100; key++) {
+        TEST_ASSERT_EQUAL_size_t(key % 2 == 0 ? 0 : 5, chmap_count(map, &key));
+    }
+
+    chmap_free(map);
+}
+
+void chmap_multimap_take_removes_one(void) {
+    struct chmap * map = chmap_new_flags(sizeof(int), sizeof(int), CHMAP_MULTIMAP);
+    int key = 7;
+    int out;
+
+    for (int i = 0; i < 3; i++) {
+        chmap_put(map, &key, &i);
+    }
+
+    TEST_ASSERT_EQUAL_INT(1, chmap_take(map, &key, &out));
+    TEST_ASSERT_EQUAL_size_t(2, chmap_count(map, &key));
+    TEST_ASSERT_NOT_NULL(chmap_get(map, &key));
+
+    chmap_free(map);
+}
+
+void chmap_count_plain_map(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    int key = 3;
+
+    chmap_put(map, &key, &key);
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_EQUAL_size_t(1, chmap_count(map, &key));
+
+    chmap_free(map);
+}
+
+void chmap_multimap_merge_appends(void) {
+    struct chmap * dst = chmap_new_flags(sizeof(int), sizeof(int), CHMAP_MULTIMAP);
+    struct chmap * src = chmap_new(sizeof(int), sizeof(int));
+
+    for (int key = 0; key < 100; key++) {
+        chmap_put(dst, &key, &key);
+        chmap_put(src, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_merge(dst, src, CHMAP_MERGE_OVERWRITE, NULL, NULL));
+
+    for (int key = 0; key < 100; key++) {
+        TEST_ASSERT_EQUAL_size_t(2, chmap_count(dst, &key));
+    }
+
+    chmap_free(src);
+    chmap_free(dst);
+}
+
+void chmap_multimap_cannot_freeze_or_journal(void) {
+    struct chmap * map = chmap_new_flags(sizeof(int), sizeof(int), CHMAP_MULTIMAP);
+    int key = 1;
+
+    chmap_put(map, &key, &key);
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_NULL(chmap_freeze(map));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_journal_open(map, "test_chmap_multimap.tmp"));
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_multimap_keeps_duplicates);
+    RUN_TEST(chmap_multimap_del_removes_all);
+    RUN_TEST(chmap_multimap_take_removes_one);
+    RUN_TEST(chmap_count_plain_map);
+    RUN_TEST(chmap_multimap_merge_appends);
+    RUN_TEST(chmap_multimap_cannot_freeze_or_journal);
+    return UNITY_END();
+}
@@ -0,0 +1,116 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static int keep_odd(const void * item, void * ctx) {
+    (void)ctx;
+
+    return *(const int *)item % 2 != 0;
+}
+
+static int keep_none(const void * item, void * ctx) {
+    (void)item;
+    (void)ctx;
+
+    return 0;
+}
+
+static int keep_below(const void * item, void * ctx) {
+    return *(const int *)item < *(int *)ctx;
+}
+
+void chmap_retain_odd(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(500, chmap_retain(map, keep_odd, NULL));
+    TEST_ASSERT_EQUAL_size_t(500, map->used_size);
+
+    for (int key = 0; key < 1000; key++) {
+        const int * got = chmap_get(map, &key);
+
+        if (key % 2 == 0) {
+            TEST_ASSERT_NULL(got);
+        } else {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_INT(key, *got);
+        }
+    }
+}
+
+void chmap_retain_none_then_reuse(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int key = 0; key < 100; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(100, chmap_retain(map, keep_none, NULL));
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+
+    for (int key = 0; key < 100; key++) {
+        TEST_ASSERT_NULL(chmap_get(map, &key));
+    }
+
+    for (int key = 0; key < 100; key++) {
+        int val = key + 1;
+        chmap_put(map, &key, &val);
+    }
+
+    for (int key = 0; key < 100; key++) {
+        TEST_ASSERT_EQUAL_INT(key + 1, *(int *)chmap_get(map, &key));
+    }
+}
+
+void chmap_retain_then_put_and_del(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int key = 0; key < 2000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    int limit = 1500;
+
+    TEST_ASSERT_EQUAL_size_t(500, chmap_retain(map, keep_below, &limit));
+
+    // The backing array slots handed back must be reusable, and the shifted entries deletable.
+    for (int key = 2000; key < 2500; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    for (int key = 0; key < 1500; key += 2) {
+        chmap_del(map, &key);
+    }
+
+    for (int key = 0; key < 2500; key++) {
+        const int * got = chmap_get(map, &key);
+
+        if ((key < 1500 && key % 2 == 0) || (key >= 1500 && key < 2000)) {
+            TEST_ASSERT_NULL(got);
+        } else {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_INT(key, *got);
+        }
+    }
+}
+
+void chmap_retain_empty(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    TEST_ASSERT_EQUAL_size_t(0, chmap_retain(map, keep_none, NULL));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_retain_odd);
+    RUN_TEST(chmap_retain_none_then_reuse);
+    RUN_TEST(chmap_retain_then_put_and_del);
+    RUN_TEST(chmap_retain_empty);
+    return UNITY_END();
+}
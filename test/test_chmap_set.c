@@ -0,0 +1,115 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+#include <stdio.h>
+
+#define JOURNAL_PATH "test_chmap_set.tmp"
+
+void setUp(void) {
+    remove(JOURNAL_PATH);
+}
+
+void tearDown(void) {
+    remove(JOURNAL_PATH);
+}
+
+
+void chmap_set_insert_contains_remove(void) {
+    struct chmap * set = chmap_set_new(sizeof(int));
+
+    for (int key = 0; key < 1000; key++) {
+        TEST_ASSERT_EQUAL_INT(1, chmap_set_insert(set, &key));
+    }
+
+    int key = 5;
+    TEST_ASSERT_EQUAL_INT(0, chmap_set_insert(set, &key));
+    TEST_ASSERT_EQUAL_size_t(1000, set->used_size);
+
+    for (key = 0; key < 1000; key += 2) {
+        TEST_ASSERT_EQUAL_INT(1, chmap_set_remove(set, &key));
+    }
+
+    key = 0;
+    TEST_ASSERT_EQUAL_INT(0, chmap_set_remove(set, &key));
+
+    for (key = 0; key < 2000; key++) {
+        TEST_ASSERT_EQUAL_INT(key < 1000 && key % 2 == 1, chmap_set_contains(set, &key));
+    }
+
+    chmap_free(set);
+}
+
+void chmap_set_has_no_item_storage(void) {
+    struct chmap * set = chmap_set_new(sizeof(int));
+    int key = 1;
+
+    chmap_set_insert(set, &key);
+
+    TEST_ASSERT_EQUAL_size_t(0, set->isize);
+    TEST_ASSERT_NULL(set->backing_array);
+    TEST_ASSERT_NULL(set->bais);
+
+    chmap_free(set);
+}
+
+void chmap_set_batched(void) {
+    struct chmap * set = chmap_set_new(sizeof(int));
+    int keys[1000];
+    unsigned char found[1000];
+
+    for (int i = 0; i < 1000; i++) {
+        // Every key twice, so half of the inserts are duplicates.
+        keys[i] = i / 2;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(500, chmap_set_insert_many(set, keys, 1000));
+    TEST_ASSERT_EQUAL_size_t(500, set->used_size);
+
+    for (int i = 0; i < 1000; i++) {
+        keys[i] = i;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(500, chmap_set_contains_many(set, keys, 1000, found));
+
+    for (int i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL_UINT8(i < 500, found[i]);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(250, chmap_set_remove_many(set, keys, 250));
+    TEST_ASSERT_EQUAL_size_t(250, chmap_set_contains_many(set, keys, 1000, NULL));
+    TEST_ASSERT_EQUAL_size_t(0, chmap_set_insert_many(set, keys, 0));
+
+    chmap_free(set);
+}
+
+void chmap_set_journal_recovers(void) {
+    struct chmap * set = chmap_set_new(sizeof(int));
+    chmap_journal_open(set, JOURNAL_PATH);
+
+    for (int key = 0; key < 100; key++) {
+        chmap_set_insert(set, &key);
+    }
+
+    for (int key = 0; key < 100; key += 3) {
+        chmap_set_remove(set, &key);
+    }
+
+    chmap_free(set);
+
+    struct chmap * recovered = chmap_set_new(sizeof(int));
+    TEST_ASSERT_EQUAL_INT(0, chmap_journal_open(recovered, JOURNAL_PATH));
+
+    for (int key = 0; key < 100; key++) {
+        TEST_ASSERT_EQUAL_INT(key % 3 != 0, chmap_set_contains(recovered, &key));
+    }
+
+    chmap_free(recovered);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_set_insert_contains_remove);
+    RUN_TEST(chmap_set_has_no_item_storage);
+    RUN_TEST(chmap_set_batched);
+    RUN_TEST(chmap_set_journal_recovers);
+    return UNITY_END();
+}
@@ -0,0 +1,106 @@
+#define CHMAP_STATS
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+void chmap_stats_empty_map(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap_stats stats;
+
+    chmap_stats(map, &stats);
+
+    TEST_ASSERT_EQUAL_size_t(0, stats.used_size);
+    TEST_ASSERT_EQUAL_size_t(map->array_size, stats.array_size);
+    TEST_ASSERT_EQUAL_size_t(0, stats.max_psl);
+    TEST_ASSERT_EQUAL_size_t(0, stats.grow_count);
+    TEST_ASSERT_TRUE(stats.load_factor == 0.0);
+    TEST_ASSERT_TRUE(stats.mean_psl == 0.0);
+
+    chmap_free(map);
+}
+
+void chmap_stats_describes_shape(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap_stats stats;
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    chmap_stats(map, &stats);
+
+    TEST_ASSERT_EQUAL_size_t(1000, stats.used_size);
+    TEST_ASSERT_EQUAL_size_t(map->array_size, stats.array_size);
+    TEST_ASSERT_TRUE(stats.load_factor > 0.0 && stats.load_factor <= 0.9);
+    TEST_ASSERT_TRUE(stats.grow_count > 0);
+    TEST_ASSERT_EQUAL_size_t(map->array_size * sizeof(int), stats.backing_array_bytes);
+    TEST_ASSERT_EQUAL_size_t(map->array_size * sizeof(size_t), stats.bais_bytes);
+
+    size_t histogram_total = 0;
+
+    for (size_t i = 0; i < CHMAP_PSL_HISTOGRAM_LENGTH; i++) {
+        histogram_total += stats.psl_histogram[i];
+    }
+
+    TEST_ASSERT_EQUAL_size_t(1000, histogram_total);
+    TEST_ASSERT_TRUE(stats.mean_psl <= (double)stats.max_psl);
+
+    chmap_free(map);
+}
+
+void chmap_stats_counts_gets(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap_stats stats;
+
+    for (int key = 0; key < 100; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    for (int key = 0; key < 150; key++) {
+        chmap_get(map, &key);
+    }
+
+    chmap_stats(map, &stats);
+
+    TEST_ASSERT_EQUAL_size_t(150, stats.counters.gets);
+    TEST_ASSERT_EQUAL_size_t(100, stats.counters.hits);
+    TEST_ASSERT_EQUAL_size_t(50, stats.counters.misses);
+    TEST_ASSERT_TRUE(stats.counters.probe_steps > 0);
+
+    chmap_free(map);
+}
+
+void chmap_stats_counts_shifts(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap_stats stats;
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    chmap_stats(map, &stats);
+    const size_t after_puts = stats.counters.shifts;
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_del(map, &key);
+    }
+
+    chmap_stats(map, &stats);
+
+    TEST_ASSERT_TRUE(after_puts > 0);
+    TEST_ASSERT_TRUE(stats.counters.shifts > after_puts);
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_stats_empty_map);
+    RUN_TEST(chmap_stats_describes_shape);
+    RUN_TEST(chmap_stats_counts_gets);
+    RUN_TEST(chmap_stats_counts_shifts);
+    return UNITY_END();
+}
@@ -0,0 +1,84 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+void chmap_take_char(void) {
+    struct chmap * map = chmap_new(sizeof(char), sizeof(char));
+
+    char put = 'A';
+    char key = 'B';
+    char out = 0;
+
+    chmap_put(map, &key, &put);
+
+    TEST_ASSERT_EQUAL_INT(1, chmap_take(map, &key, &out));
+    TEST_ASSERT_EQUAL_UINT8('A', out);
+    TEST_ASSERT_NULL(chmap_get(map, &key));
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+
+    chmap_free(map);
+}
+
+void chmap_take_missing(void) {
+    struct chmap * map = chmap_new(sizeof(char), sizeof(char));
+
+    char key = 'B';
+    char out = 'x';
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_take(map, &key, &out));
+    TEST_ASSERT_EQUAL_UINT8('x', out);
+
+    chmap_free(map);
+}
+
+void chmap_take_without_output(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    int key = 3;
+
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_EQUAL_INT(1, chmap_take(map, &key, NULL));
+    TEST_ASSERT_EQUAL_INT(0, chmap_take(map, &key, NULL));
+
+    chmap_free(map);
+}
+
+void chmap_take_drains_queue(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int key = 0; key < 500; key++) {
+        int val = key * 2;
+
+        chmap_put(map, &key, &val);
+    }
+
+    for (int key = 0; key < 500; key++) {
+        int out;
+
+        TEST_ASSERT_EQUAL_INT(1, chmap_take(map, &key, &out));
+        TEST_ASSERT_EQUAL_INT(key * 2, out);
+
+        int next = key + 1;
+
+        if (next < 500) {
+            TEST_ASSERT_NOT_NULL(chmap_get(map, &next));
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_take_char);
+    RUN_TEST(chmap_take_missing);
+    RUN_TEST(chmap_take_without_output);
+    RUN_TEST(chmap_take_drains_queue);
+    return UNITY_END();
+}
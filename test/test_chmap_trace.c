@@ -0,0 +1,148 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+struct grow_log {
+    size_t starts;
+    size_t ends;
+    size_t last_capacity;
+    int in_progress;
+};
+
+static void log_grow(const struct chmap_grow_event * event, void * ctx) {
+    struct grow_log * log = ctx;
+
+    if (event->phase == CHMAP_GROW_START) {
+        TEST_ASSERT_FALSE(log->in_progress);
+        TEST_ASSERT_EQUAL_size_t(log->last_capacity, event->old_capacity);
+        TEST_ASSERT_EQUAL_UINT64(0, event->elapsed_ns);
+        log->starts++;
+        log->in_progress = 1;
+    } else {
+        TEST_ASSERT_TRUE(log->in_progress);
+        log->ends++;
+        log->in_progress = 0;
+        log->last_capacity = event->new_capacity;
+    }
+
+    TEST_ASSERT_TRUE(event->new_capacity > event->old_capacity);
+}
+
+void chmap_grow_hook_brackets_every_resize(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct grow_log log = {0, 0, map->array_size, 0};
+
+    chmap_set_grow_hook(map, log_grow, &log);
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    chmap_reserve(map, 10000);
+
+    TEST_ASSERT_EQUAL_size_t(map->grow_count, log.starts);
+    TEST_ASSERT_EQUAL_size_t(map->grow_count, log.ends);
+    TEST_ASSERT_EQUAL_size_t(map->array_size, log.last_capacity);
+
+    chmap_set_grow_hook(map, NULL, NULL);
+    chmap_reserve(map, 100000);
+
+    TEST_ASSERT_EQUAL_size_t(map->grow_count - 1, log.starts);
+
+    chmap_free(map);
+}
+
+void chmap_trace_is_off_by_default(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    int key = 1;
+
+    chmap_put(map, &key, &key);
+
+    TEST_ASSERT_NULL(chmap_get_trace(map));
+
+    chmap_free(map);
+}
+
+void chmap_trace_records_each_operation(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_trace_enable(map));
+
+    for (int key = 0; key < 1000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    for (int key = 0; key < 500; key++) {
+        chmap_get(map, &key);
+    }
+
+    for (int key = 0; key < 200; key++) {
+        chmap_del(map, &key);
+    }
+
+    const struct chmap_trace * trace = chmap_get_trace(map);
+
+    TEST_ASSERT_NOT_NULL(trace);
+    TEST_ASSERT_EQUAL_UINT64(1000, trace->put.count);
+    TEST_ASSERT_EQUAL_UINT64(500, trace->get.count);
+    TEST_ASSERT_EQUAL_UINT64(200, trace->del.count);
+    TEST_ASSERT_EQUAL_UINT64(map->grow_count, trace->growing_put.count);
+
+    chmap_trace_disable(map);
+    TEST_ASSERT_NULL(chmap_get_trace(map));
+
+    chmap_free(map);
+}
+
+void chmap_histogram_percentiles_are_ordered(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    chmap_trace_enable(map);
+
+    for (int key = 0; key < 10000; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    const struct chmap_histogram * put = &chmap_get_trace(map)->put;
+    const uint64_t p50 = chmap_histogram_percentile(put, 50.0);
+    const uint64_t p99 = chmap_histogram_percentile(put, 99.0);
+    const uint64_t p100 = chmap_histogram_percentile(put, 100.0);
+
+    TEST_ASSERT_TRUE(p50 <= p99);
+    TEST_ASSERT_TRUE(p99 <= p100);
+    TEST_ASSERT_EQUAL_UINT64(put->max, p100);
+
+    struct chmap_histogram empty = {0};
+    TEST_ASSERT_EQUAL_UINT64(0, chmap_histogram_percentile(&empty, 99.0));
+
+    chmap_free(map);
+}
+
+void chmap_clone_does_not_inherit_tracing(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct grow_log log = {0, 0, 0, 0};
+
+    chmap_trace_enable(map);
+    chmap_set_grow_hook(map, log_grow, &log);
+
+    struct chmap * clone = chmap_clone(map);
+
+    TEST_ASSERT_NULL(chmap_get_trace(clone));
+    TEST_ASSERT_NULL(clone->grow_hook);
+
+    chmap_free(clone);
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_grow_hook_brackets_every_resize);
+    RUN_TEST(chmap_trace_is_off_by_default);
+    RUN_TEST(chmap_trace_records_each_operation);
+    RUN_TEST(chmap_histogram_percentiles_are_ordered);
+    RUN_TEST(chmap_clone_does_not_inherit_tracing);
+    return UNITY_END();
+}
@@ -0,0 +1,408 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static int has_key(struct chmap * map, int key) {
+    // Gets remove expired entries, so look without them.
+    return find_hash(map, chmap_hash(map, &key)) != map->array_size;
+}
+
+static void count_expired(const void * item, void * ctx) {
+    (void)item;
+
+    (*(size_t *)ctx)++;
+}
+
+static void sum_expired(const void * item, void * ctx) {
+    *(int *)ctx += *(const int *)item;
+}
+
+static void add_ints(void * dst_item, const void * src_item, void * ctx) {
+    (void)ctx;
+
+    *(int *)dst_item += *(const int *)src_item;
+}
+
+void chmap_ttl_get_expires_lazily(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    int expired = 0;
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_ttl_enable(map, 100, sum_expired, &expired));
+
+    int key = 1;
+    int item = 10;
+    TEST_ASSERT_EQUAL_INT(0, chmap_put_ttl(map, &key, &item, 110));
+    key = 2;
+    item = 20;
+    chmap_put(map, &key, &item);
+
+    chmap_ttl_set_now(map, 109);
+    key = 1;
+    TEST_ASSERT_EQUAL_INT(10, *(int *)chmap_get(map, &key));
+
+    chmap_ttl_set_now(map, 110);
+    TEST_ASSERT_NULL(chmap_get(map, &key));
+    TEST_ASSERT_EQUAL_INT(10, expired);
+    TEST_ASSERT_EQUAL_size_t(1, map->used_size);
+
+    // The wheel has nothing left in it, so expiring finds nothing more.
+    TEST_ASSERT_EQUAL_size_t(0, chmap_expire(map, 1000));
+    key = 2;
+    TEST_ASSERT_EQUAL_INT(20, *(int *)chmap_get(map, &key));
+
+    chmap_free(map);
+}
+
+void chmap_ttl_expire_sweeps_every_level(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    size_t expired = 0;
+    const int count = 20000;
+
+    chmap_ttl_enable(map, 0, count_expired, &expired);
+
+    // Expiries spread from the next tick out past the top level of the wheel.
+    for (int key = 0; key < count; key++) {
+        const uint64_t expires = key < 10 ? (UINT64_C(1) << 24) + key : (uint64_t)key * 7919 % 3000000 + 1;
+
+        chmap_put_ttl(map, &key, &key, expires);
+    }
+
+    uint64_t now = 0;
+    size_t total = 0;
+
+    while (now < (UINT64_C(1) << 24) + 10) {
+        now += now < 4000000 ? 4093 : 1000003;
+        total += chmap_expire(map, now);
+
+        for (int key = 0; key < count; key += 97) {
+            const uint64_t expires = key < 10 ? (UINT64_C(1) << 24) + key : (uint64_t)key * 7919 % 3000000 + 1;
+
+            TEST_ASSERT_EQUAL(expires > now, has_key(map, key));
+        }
+
+        TEST_ASSERT_EQUAL_size_t(count - total, map->used_size);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(count, total);
+    TEST_ASSERT_EQUAL_size_t(count, expired);
+    TEST_ASSERT_EQUAL_size_t(0, map->ttl->count);
+
+    chmap_free(map);
+}
+
+void chmap_ttl_expires_on_wheel_boundaries(void) {
+    // Ticks on either side of where each level of the wheel wraps around.
+    static const uint64_t ticks[] = {
+        1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 8192, 262143, 262144, 262145, 16777215, 16777216, 16777217,
+    };
+    const size_t tick_count = sizeof(ticks) / sizeof(ticks[0]);
+    const int pending = 2;
+
+    for (size_t n = 0; n < tick_count; n++) {
+        for (size_t e = 0; e < tick_count; e++) {
+            const uint64_t now = ticks[n];
+            const uint64_t expires_at = ticks[e];
+
+            // Stepping the wheel across millions of ticks adds nothing the shorter pairs don't cover.
+            if (expires_at > now && expires_at - now > 300000) {
+                continue;
+            }
+
+            struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+            size_t expired = 0;
+            int key = 1;
+
+            // Another key stays in the wheel throughout, so that the wheel never skips ahead.
+            chmap_ttl_enable(map, now - 1, count_expired, &expired);
+            chmap_put_ttl(map, &pending, &pending, UINT64_MAX);
+            chmap_expire(map, now);
+            chmap_put_ttl(map, &key, &key, expires_at);
+
+            if (expires_at > now) {
+                TEST_ASSERT_EQUAL_size_t(0, chmap_expire(map, expires_at - 1));
+                TEST_ASSERT_TRUE(has_key(map, key));
+            }
+
+            // Expiries at or before the current tick are removed by the next call, even at the same time.
+            TEST_ASSERT_EQUAL_size_t(1, chmap_expire(map, expires_at > now ? expires_at : now));
+            TEST_ASSERT_FALSE(has_key(map, key));
+            TEST_ASSERT_EQUAL_size_t(1, expired);
+            TEST_ASSERT_TRUE(has_key(map, pending));
+
+            chmap_free(map);
+        }
+    }
+}
+
+void chmap_ttl_put_replaces_expired(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    int expired = 0;
+    int key = 1;
+    int item = 10;
+
+    chmap_ttl_enable(map, 100, sum_expired, &expired);
+    chmap_put_ttl(map, &key, &item, 110);
+    chmap_ttl_set_now(map, 150);
+
+    // The old item expired, so this is a fresh put, and the new item doesn't inherit its expiry.
+    item = 20;
+    TEST_ASSERT_EQUAL_INT(0, chmap_put(map, &key, &item));
+    TEST_ASSERT_EQUAL_INT(10, expired);
+    TEST_ASSERT_EQUAL_INT(20, *(int *)chmap_get(map, &key));
+    TEST_ASSERT_EQUAL_size_t(0, chmap_expire(map, 1000));
+    TEST_ASSERT_EQUAL_INT(20, *(int *)chmap_get(map, &key));
+
+    chmap_free(map);
+}
+
+void chmap_ttl_upsert_and_add_start_over(void) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(int));
+    uint64_t item = 7;
+    int inserted;
+    int key = 1;
+
+    chmap_ttl_enable(map, 0, NULL, NULL);
+    chmap_put_ttl(map, &key, &item, 10);
+    key = 2;
+    chmap_put_ttl(map, &key, &item, 10);
+    chmap_ttl_set_now(map, 10);
+
+    key = 1;
+    uint64_t * upserted = chmap_upsert(map, &key, &inserted);
+    TEST_ASSERT_EQUAL_INT(1, inserted);
+    TEST_ASSERT_EQUAL_UINT64(0, *upserted);
+
+    key = 2;
+    TEST_ASSERT_EQUAL_UINT64(5, chmap_add_u64(map, &key, 5));
+
+    chmap_free(map);
+}
+
+void chmap_ttl_take_skips_expired(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    int expired = 0;
+    int key = 1;
+    int item = 10;
+    int out = 0;
+
+    chmap_ttl_enable(map, 0, sum_expired, &expired);
+    chmap_put_ttl(map, &key, &item, 10);
+    chmap_ttl_set_now(map, 10);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_take(map, &key, &out));
+    TEST_ASSERT_EQUAL_INT(0, out);
+    TEST_ASSERT_EQUAL_INT(10, expired);
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+
+    chmap_free(map);
+}
+
+void chmap_ttl_merge_skips_expired(void) {
+    struct chmap * dst = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * src = chmap_new(sizeof(int), sizeof(int));
+    int expired = 0;
+    int key = 1;
+    int item = 10;
+
+    chmap_ttl_enable(dst, 0, sum_expired, &expired);
+    chmap_ttl_enable(src, 0, NULL, NULL);
+    chmap_put_ttl(dst, &key, &item, 10);
+    chmap_ttl_set_now(dst, 10);
+
+    // Key 1 comes from src fresh, while key 2 has expired in src, so it isn't merged at all.
+    item = 5;
+    chmap_put(src, &key, &item);
+    key = 2;
+    chmap_put_ttl(src, &key, &item, 10);
+    chmap_ttl_set_now(src, 10);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_merge(dst, src, CHMAP_MERGE_COMBINE, add_ints, NULL));
+    TEST_ASSERT_EQUAL_INT(10, expired);
+    TEST_ASSERT_EQUAL_size_t(1, dst->used_size);
+
+    key = 1;
+    TEST_ASSERT_EQUAL_INT(5, *(int *)chmap_get(dst, &key));
+    TEST_ASSERT_EQUAL_size_t(0, chmap_expire(dst, 1000));
+    TEST_ASSERT_EQUAL_INT(5, *(int *)chmap_get(dst, &key));
+
+    chmap_free(src);
+    chmap_free(dst);
+}
+
+void chmap_ttl_lookups_skip_expired(void) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(int));
+    uint64_t item = 10;
+
+    chmap_ttl_enable(map, 0, NULL, NULL);
+
+    for (int key = 0; key < 3; key++) {
+        chmap_put_ttl(map, &key, &item, 10);
+    }
+
+    chmap_ttl_set_now(map, 10);
+
+    // Giving an expired entry a new expiry doesn't bring it back.
+    int key = 0;
+    TEST_ASSERT_EQUAL_INT(0, chmap_set_expiry(map, &key, 100));
+    TEST_ASSERT_FALSE(has_key(map, key));
+
+    key = 1;
+    TEST_ASSERT_EQUAL_size_t(0, chmap_count(map, &key));
+    TEST_ASSERT_FALSE(has_key(map, key));
+
+#ifdef __GNUC__
+    key = 2;
+    TEST_ASSERT_EQUAL_INT(0, chmap_atomic_add_u64(map, &key, 1));
+    TEST_ASSERT_FALSE(has_key(map, key));
+#endif
+
+    chmap_free(map);
+}
+
+void chmap_ttl_set_expiry(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    int key;
+
+    chmap_ttl_enable(map, 0, NULL, NULL);
+
+    for (key = 0; key < 4; key++) {
+        chmap_put_ttl(map, &key, &key, 10);
+    }
+
+    // Never expire 0, expire 1 later, and expire 2 right away; putting 3 again keeps its expiry.
+    key = 0;
+    TEST_ASSERT_EQUAL_INT(1, chmap_set_expiry(map, &key, 0));
+    key = 1;
+    TEST_ASSERT_EQUAL_INT(1, chmap_set_expiry(map, &key, 20));
+    key = 2;
+    TEST_ASSERT_EQUAL_INT(1, chmap_set_expiry(map, &key, 1));
+    key = 3;
+    chmap_put(map, &key, &key);
+    key = 4;
+    TEST_ASSERT_EQUAL_INT(0, chmap_set_expiry(map, &key, 5));
+
+    TEST_ASSERT_EQUAL_size_t(1, chmap_expire(map, 1));
+    TEST_ASSERT_FALSE(has_key(map, 2));
+
+    TEST_ASSERT_EQUAL_size_t(1, chmap_expire(map, 10));
+    TEST_ASSERT_FALSE(has_key(map, 3));
+
+    // Deleted entries leave the wheel too.
+    key = 1;
+    chmap_del(map, &key);
+    TEST_ASSERT_EQUAL_size_t(0, chmap_expire(map, 100));
+    TEST_ASSERT_TRUE(has_key(map, 0));
+
+    chmap_free(map);
+}
+
+void chmap_ttl_keys_without_items(void) {
+    struct chmap * map = chmap_new(0, sizeof(int));
+    size_t expired = 0;
+
+    chmap_ttl_enable(map, 0, count_expired, &expired);
+
+    // The items are 0 bytes, so nothing is read from them.
+    for (int key = 0; key < 100; key++) {
+        TEST_ASSERT_EQUAL_INT(0, chmap_put_ttl(map, &key, &key, key % 2 ? 10 : 20));
+    }
+
+    int key = 1;
+    TEST_ASSERT_EQUAL_INT(1, chmap_put_ttl(map, &key, &key, 30));
+
+    TEST_ASSERT_EQUAL_size_t(49, chmap_expire(map, 10));
+    TEST_ASSERT_TRUE(has_key(map, 1));
+    TEST_ASSERT_FALSE(has_key(map, 3));
+    TEST_ASSERT_EQUAL_size_t(50, chmap_expire(map, 20));
+    TEST_ASSERT_EQUAL_size_t(1, chmap_expire(map, 30));
+    TEST_ASSERT_EQUAL_size_t(100, expired);
+    TEST_ASSERT_EQUAL_size_t(0, map->used_size);
+
+    chmap_free(map);
+}
+
+void chmap_ttl_survives_resize_clear_and_clone(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    int key;
+
+    // Entries put before enabling expiry can still be given one.
+    for (key = 0; key < 5; key++) {
+        chmap_put(map, &key, &key);
+    }
+
+    chmap_ttl_enable(map, 0, NULL, NULL);
+    key = 0;
+    chmap_set_expiry(map, &key, 50);
+
+    for (key = 5; key < 1000; key++) {
+        chmap_put_ttl(map, &key, &key, key % 2 ? 100 : 0);
+    }
+
+    struct chmap * clone = chmap_clone(map);
+    struct chmap * copy = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * plain = chmap_new(sizeof(int), sizeof(int));
+
+    chmap_ttl_enable(copy, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL_INT(-1, chmap_copy(plain, map));
+    TEST_ASSERT_EQUAL_INT(0, chmap_copy(copy, map));
+
+    TEST_ASSERT_EQUAL_size_t(1, chmap_expire(map, 50));
+    TEST_ASSERT_EQUAL_size_t(498, chmap_expire(map, 100));
+    TEST_ASSERT_EQUAL_size_t(501, map->used_size);
+    TEST_ASSERT_EQUAL_size_t(499, chmap_expire(clone, 100));
+    TEST_ASSERT_EQUAL_size_t(499, chmap_expire(copy, 100));
+
+    chmap_clear(clone);
+    key = 7;
+    chmap_put_ttl(clone, &key, &key, 200);
+    TEST_ASSERT_EQUAL_size_t(1, chmap_expire(clone, 200));
+    TEST_ASSERT_EQUAL_size_t(0, clone->used_size);
+
+    chmap_free(plain);
+    chmap_free(copy);
+    chmap_free(clone);
+    chmap_free(map);
+}
+
+void chmap_ttl_enable_rejects(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+    struct chmap * inline_map = chmap_new_flags(sizeof(int), sizeof(int), CHMAP_INLINE_ITEMS);
+    struct chmap * multimap = chmap_new_flags(sizeof(int), sizeof(int), CHMAP_MULTIMAP);
+
+    TEST_ASSERT_EQUAL_INT(0, chmap_ttl_enable(map, 0, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_ttl_enable(map, 0, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_ttl_enable(inline_map, 0, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_ttl_enable(multimap, 0, NULL, NULL));
+
+    // Maps without expiry turn the rest away too.
+    int key = 1;
+    TEST_ASSERT_EQUAL_INT(-1, chmap_ttl_set_now(inline_map, 10));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_put_ttl(inline_map, &key, &key, 10));
+    TEST_ASSERT_EQUAL_INT(-1, chmap_set_expiry(inline_map, &key, 10));
+    TEST_ASSERT_EQUAL_size_t(0, chmap_expire(inline_map, 10));
+    TEST_ASSERT_EQUAL_size_t(0, inline_map->used_size);
+
+    chmap_free(multimap);
+    chmap_free(inline_map);
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_ttl_get_expires_lazily);
+    RUN_TEST(chmap_ttl_expire_sweeps_every_level);
+    RUN_TEST(chmap_ttl_expires_on_wheel_boundaries);
+    RUN_TEST(chmap_ttl_put_replaces_expired);
+    RUN_TEST(chmap_ttl_upsert_and_add_start_over);
+    RUN_TEST(chmap_ttl_take_skips_expired);
+    RUN_TEST(chmap_ttl_merge_skips_expired);
+    RUN_TEST(chmap_ttl_lookups_skip_expired);
+    RUN_TEST(chmap_ttl_set_expiry);
+    RUN_TEST(chmap_ttl_keys_without_items);
+    RUN_TEST(chmap_ttl_survives_resize_clear_and_clone);
+    RUN_TEST(chmap_ttl_enable_rejects);
+    return UNITY_END();
+}
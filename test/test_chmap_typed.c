@@ -0,0 +1,181 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+#include <string.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+static uint64_t hash_string(const char * key) {
+    uint64_t hash = UINT64_C(14695981039346656037);
+
+    for (; *key != '\0'; key++) {
+        hash = (hash ^ (unsigned char)*key) * UINT64_C(1099511628211);
+    }
+
+    return hash;
+}
+
+static int eq_string(const char * a, const char * b) {
+    return strcmp(a, b) == 0;
+}
+
+// A hash that sends every key to the same slot, so that everything collides.
+#define HASH_CONSTANT(key) ((void)(key), UINT64_C(7))
+
+CHMAP_DEFINE(u64_u32_map, uint64_t, uint32_t, chmap_hash_u64, CHMAP_EQ)
+CHMAP_DEFINE(string_map, const char *, int, hash_string, eq_string)
+CHMAP_DEFINE(colliding_map, int, int, HASH_CONSTANT, CHMAP_EQ)
+
+void chmap_typed_put_get(void) {
+    struct u64_u32_map * map = u64_u32_map_new();
+
+    for (uint64_t key = 0; key < 10000; key++) {
+        TEST_ASSERT_EQUAL_INT(0, u64_u32_map_put(map, key * 7, (uint32_t)key));
+    }
+
+    TEST_ASSERT_EQUAL_size_t(10000, map->used_size);
+
+    for (uint64_t key = 0; key < 10000; key++) {
+        const uint32_t * got = u64_u32_map_get(map, key * 7);
+
+        TEST_ASSERT_NOT_NULL(got);
+        TEST_ASSERT_EQUAL_UINT32(key, *got);
+    }
+
+    TEST_ASSERT_NULL(u64_u32_map_get(map, 1));
+
+    u64_u32_map_free(map);
+}
+
+void chmap_typed_put_overwrites(void) {
+    struct u64_u32_map * map = u64_u32_map_new();
+
+    TEST_ASSERT_EQUAL_INT(0, u64_u32_map_put(map, 5, 1));
+    TEST_ASSERT_EQUAL_INT(1, u64_u32_map_put(map, 5, 2));
+
+    TEST_ASSERT_EQUAL_size_t(1, map->used_size);
+    TEST_ASSERT_EQUAL_UINT32(2, *u64_u32_map_get(map, 5));
+
+    u64_u32_map_free(map);
+}
+
+void chmap_typed_del(void) {
+    struct u64_u32_map * map = u64_u32_map_new();
+
+    for (uint64_t key = 0; key < 5000; key++) {
+        u64_u32_map_put(map, key, (uint32_t)key);
+    }
+
+    for (uint64_t key = 0; key < 5000; key += 2) {
+        TEST_ASSERT_EQUAL_INT(1, u64_u32_map_del(map, key));
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, u64_u32_map_del(map, 0));
+    TEST_ASSERT_EQUAL_size_t(2500, map->used_size);
+
+    for (uint64_t key = 0; key < 5000; key++) {
+        const uint32_t * got = u64_u32_map_get(map, key);
+
+        if (key % 2 == 0) {
+            TEST_ASSERT_NULL(got);
+        } else {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_UINT32(key, *got);
+        }
+    }
+
+    u64_u32_map_free(map);
+}
+
+void chmap_typed_string_keys(void) {
+    struct string_map * map = string_map_new();
+    char lookup[16];
+
+    string_map_put(map, "apple", 1);
+    string_map_put(map, "banana", 2);
+    string_map_put(map, "cherry", 3);
+
+    // Keys are compared with eq_fn, not by pointer.
+    strcpy(lookup, "banana");
+    TEST_ASSERT_EQUAL_INT(2, *string_map_get(map, lookup));
+    TEST_ASSERT_NULL(string_map_get(map, "durian"));
+
+    string_map_free(map);
+}
+
+void chmap_typed_full_collisions(void) {
+    struct colliding_map * map = colliding_map_new();
+
+    for (int key = 0; key < 200; key++) {
+        colliding_map_put(map, key, -key);
+    }
+
+    for (int key = 0; key < 200; key += 3) {
+        colliding_map_del(map, key);
+    }
+
+    for (int key = 0; key < 200; key++) {
+        const int * got = colliding_map_get(map, key);
+
+        if (key % 3 == 0) {
+            TEST_ASSERT_NULL(got);
+        } else {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_INT(-key, *got);
+        }
+    }
+
+    colliding_map_free(map);
+}
+
+void chmap_typed_matches_chmap(void) {
+    struct u64_u32_map * typed = u64_u32_map_new();
+    struct chmap * map = chmap_new(sizeof(uint32_t), sizeof(uint64_t));
+    uint64_t state = 88172645463325252ULL;
+
+    for (int i = 0; i < 100000; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        const uint64_t key = state % 4096;
+        const uint32_t val = (uint32_t)i;
+
+        if (state % 3 == 0) {
+            chmap_del(map, &key);
+            u64_u32_map_del(typed, key);
+        } else {
+            chmap_put(map, &key, &val);
+            u64_u32_map_put(typed, key, val);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(map->used_size, typed->used_size);
+
+    for (uint64_t key = 0; key < 4096; key++) {
+        const uint32_t * expected = chmap_get(map, &key);
+        const uint32_t * got = u64_u32_map_get(typed, key);
+
+        if (expected == NULL) {
+            TEST_ASSERT_NULL(got);
+        } else {
+            TEST_ASSERT_NOT_NULL(got);
+            TEST_ASSERT_EQUAL_UINT32(*expected, *got);
+        }
+    }
+
+    chmap_free(map);
+    u64_u32_map_free(typed);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_typed_put_get);
+    RUN_TEST(chmap_typed_put_overwrites);
+    RUN_TEST(chmap_typed_del);
+    RUN_TEST(chmap_typed_string_keys);
+    RUN_TEST(chmap_typed_full_collisions);
+    RUN_TEST(chmap_typed_matches_chmap);
+    return UNITY_END();
+}
@@ -0,0 +1,73 @@
+#include "../unity/src/unity.h"
+#include "../chmap_onefile.h"
+#include <stdint.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+
+void chmap_upsert_inserts_zeroed(void) {
+    struct chmap * map = chmap_new(sizeof(uint64_t), sizeof(char));
+
+    char key = 'B';
+    int inserted = -1;
+
+    uint64_t * got = chmap_upsert(map, &key, &inserted);
+
+    TEST_ASSERT_NOT_NULL(got);
+    TEST_ASSERT_EQUAL_INT(1, inserted);
+    TEST_ASSERT_EQUAL_UINT64(0, *got);
+    TEST_ASSERT_EQUAL_size_t(1, map->used_size);
+
+    *got = 42;
+
+    TEST_ASSERT_EQUAL_UINT64(42, *(uint64_t *)chmap_get(map, &key));
+
+    chmap_free(map);
+}
+
+void chmap_upsert_finds_existing(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(char));
+
+    char key = 'B';
+    int put = 7;
+    int inserted = -1;
+
+    chmap_put(map, &key, &put);
+
+    int * got = chmap_upsert(map, &key, &inserted);
+
+    TEST_ASSERT_EQUAL_INT(0, inserted);
+    TEST_ASSERT_EQUAL_INT(7, *got);
+    TEST_ASSERT_EQUAL_size_t(1, map->used_size);
+
+    chmap_free(map);
+}
+
+void chmap_upsert_counts(void) {
+    struct chmap * map = chmap_new(sizeof(int), sizeof(int));
+
+    for (int i = 0; i < 10000; i++) {
+        int key = i % 300;
+
+        (*(int *)chmap_upsert(map, &key, NULL))++;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(300, map->used_size);
+
+    for (int key = 0; key < 300; key++) {
+        const int expected = 10000 / 300 + (key < 10000 % 300 ? 1 : 0);
+
+        TEST_ASSERT_EQUAL_INT(expected, *(int *)chmap_get(map, &key));
+    }
+
+    chmap_free(map);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(chmap_upsert_inserts_zeroed);
+    RUN_TEST(chmap_upsert_finds_existing);
+    RUN_TEST(chmap_upsert_counts);
+    return UNITY_END();
+}